@@ -0,0 +1,149 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * allocator.c - A table of allocator entry points so the harnesses can run
+ * the same trace against umalloc, glibc malloc or a umalloc variant loaded
+ * from a shared object with dlopen.
+ *
+ * A backend is named on the command line by one of
+ *   umalloc  - the umalloc linked into the harness (the default)
+ *   glibc    - the C library's malloc and free
+ *   path.so  - a shared object exporting uinit, umalloc and ufree, such as
+ *              the umalloc.so target built from an older checkout. urealloc
+ *              is optional, without it realloc ops move every block.
+ **************************************************************************/
+
+#include "allocator.h"
+#include "umalloc.h"
+#include "csbrk.h"
+#include "support.h"
+#include <dlfcn.h>
+#include <malloc.h>
+
+extern size_t sbrk_bytes;
+
+static size_t umalloc_heap_bytes(allocator_t *self) {
+    return sbrk_bytes;
+}
+
+static int glibc_init(void) {
+    return 0;
+}
+
+/*
+ * glibc_heap_bytes - bytes glibc holds in its arenas plus mmapped chunks.
+ */
+static size_t glibc_heap_bytes(allocator_t *self) {
+    struct mallinfo2 info = mallinfo2();
+    return info.arena + info.hblkhd;
+}
+
+static size_t variant_heap_bytes(allocator_t *self) {
+    return self->sbrk_bytes ? *self->sbrk_bytes : 0;
+}
+
+/*
+ * load_variant - loads a shared object and looks up the umalloc entry points.
+ * Returns false, with the reason in msg, if any is missing.
+ */
+static bool load_variant(allocator_t *alloc, const char *path) {
+    alloc->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!alloc->handle) {
+        snprintf(msg, MAXLINE, "Could not load %s: %s", path, dlerror());
+        return false;
+    }
+    alloc->init = (int (*)(void)) dlsym(alloc->handle, "uinit");
+    alloc->malloc = (void *(*)(size_t)) dlsym(alloc->handle, "umalloc");
+    alloc->free = (void (*)(void *)) dlsym(alloc->handle, "ufree");
+    if (!alloc->init || !alloc->malloc || !alloc->free) {
+        snprintf(msg, MAXLINE, "%s does not export uinit, umalloc and ufree", path);
+        dlclose(alloc->handle);
+        return false;
+    }
+    //present only if the variant was built with its own tracked csbrk
+    alloc->sbrk_bytes = dlsym(alloc->handle, "sbrk_bytes");
+    alloc->realloc = (void *(*)(void *, size_t)) dlsym(alloc->handle, "urealloc");
+    alloc->check_output = (int (*)(void *, size_t)) dlsym(alloc->handle, "check_malloc_output");
+    alloc->heap_bytes = variant_heap_bytes;
+    return true;
+}
+
+/*
+ * allocator_load - builds the entry point table for a backend spec. Calls
+ * appl_error if the backend can't be loaded.
+ */
+allocator_t *allocator_load(const char *spec) {
+    allocator_t *alloc = calloc(1, sizeof(allocator_t));
+    const char *base = strrchr(spec, '/');
+    snprintf(alloc->name, sizeof(alloc->name), "%s", base ? base + 1 : spec);
+
+    if (!strcmp(spec, "umalloc")) {
+        alloc->init = uinit;
+        alloc->malloc = umalloc;
+        alloc->free = ufree;
+        alloc->realloc = urealloc;
+        alloc->heap_bytes = umalloc_heap_bytes;
+        alloc->check_output = check_malloc_output;
+        alloc->native = true;
+    } else if (!strcmp(spec, "glibc")) {
+        alloc->init = glibc_init;
+        alloc->malloc = malloc;
+        alloc->free = free;
+        alloc->realloc = realloc;
+        alloc->heap_bytes = glibc_heap_bytes;
+    } else if (!load_variant(alloc, spec)) {
+        free(alloc);
+        appl_error(msg);
+    }
+    return alloc;
+}
+
+/*
+ * allocator_init - starts a backend on a fresh heap, returns init's result.
+ */
+int allocator_init(allocator_t *alloc) {
+    alloc->baseline = alloc->heap_bytes(alloc);
+    if (alloc->heap_bytes == glibc_heap_bytes) {
+        //glibc keeps the free memory it already held, only the harness's own
+        //live chunks belong to someone else
+        struct mallinfo2 info = mallinfo2();
+        alloc->baseline = info.uordblks + info.hblkhd;
+    }
+    return alloc->init();
+}
+
+/*
+ * allocator_heap_bytes - bytes the backend has taken from the OS since
+ * allocator_init. glibc can't be reset, so what the harness itself had
+ * allocated before init is left out.
+ */
+size_t allocator_heap_bytes(allocator_t *alloc) {
+    size_t bytes = alloc->heap_bytes(alloc);
+    return bytes > alloc->baseline ? bytes - alloc->baseline : 0;
+}
+
+/*
+ * allocator_realloc - resizes ptr through the backend's realloc. Backends
+ * without one get a new block, old_size bytes copied over and a free.
+ */
+void *allocator_realloc(allocator_t *alloc, void *ptr, size_t old_size, size_t size) {
+    if (alloc->realloc) {
+        return alloc->realloc(ptr, size);
+    }
+    void *moved = alloc->malloc(size);
+    if (moved && ptr) {
+        memcpy(moved, ptr, old_size < size ? old_size : size);
+        alloc->free(ptr);
+    }
+    return moved;
+}
+
+/*
+ * allocator_unload - releases a backend and closes its shared object.
+ */
+void allocator_unload(allocator_t *alloc) {
+    if (alloc->handle) {
+        dlclose(alloc->handle);
+    }
+    free(alloc);
+}
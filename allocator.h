@@ -0,0 +1,34 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * allocator.h - A table of allocator entry points so the harnesses can run
+ * the same trace against umalloc, glibc malloc or a umalloc variant loaded
+ * from a shared object with dlopen.
+ **************************************************************************/
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct allocator {
+    char name[64];
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size); /* NULL if the backend has none */
+    /* bytes the backend has taken from the OS so far */
+    size_t (*heap_bytes)(struct allocator *self);
+    /* checks a payload lies in memory the backend owns, NULL if it can't tell */
+    int (*check_output)(void *payload, size_t length);
+    size_t *sbrk_bytes; /* csbrk byte counter of a dlopen variant, NULL if untracked */
+    size_t baseline;    /* heap_bytes before init */
+    void *handle;       /* dlopen handle, NULL for built in backends */
+    bool native;        /* the umalloc linked into the harness, check_heap and heap maps work */
+} allocator_t;
+
+#define MAX_ALLOCATORS 8
+
+allocator_t *allocator_load(const char *spec);
+int allocator_init(allocator_t *alloc);
+size_t allocator_heap_bytes(allocator_t *alloc);
+void *allocator_realloc(allocator_t *alloc, void *ptr, size_t old_size, size_t size);
+void allocator_unload(allocator_t *alloc);
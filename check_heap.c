@@ -1,8 +1,9 @@
 
 #include "umalloc.h"
+#include "size_classes.h"
 
 //Place any variables needed here from umalloc.c as an extern.
-extern memory_block_t *free_head;
+extern heap_arena_t arenas[NUM_HEAPS];
 extern memory_block_t *alloc_head;
 
 /*
@@ -24,63 +25,167 @@ int check_alignment(memory_block_t *block) {
 }
 
 /*
- * check_heap -  used to check that the heap is still in a consistent state.
- * Required to be completed for checkpoint 1.
- * Should return 0 if the heap is still consistent, otherwise return a non-zero
- * return code. Asserts are also a useful tool here.
+ * check_arena - runs the heap checks that concern a single arena: its free
+ * lists and fast bins. Returns 0 if the arena is consistent, otherwise the
+ * code of the failed check.
  */
-int check_heap() {
-
-    // Example heap check:
+static int check_arena(heap_arena_t *arena) {
 
     //HEAP CHECK #1
-    // Check that all blocks in the free list are marked free.
+    // Check that all blocks in the free lists are marked free.
     // If a block is marked allocated, return 10.
-    memory_block_t *cur = free_head;
-    while (cur) {
-        if (is_allocated(cur)) {
-            return 10;
+    memory_block_t *cur;
+    for (int class = 0; class < NUM_SIZE_CLASSES; class++) {
+        for (cur = arena->free_lists[class]; cur; cur = cur->next) {
+            if (is_allocated(cur)) {
+                return 10;
+            }
         }
-        cur = cur->next;
     }
 
 
     //HEAP CHECK #2
-    // Check that all free and allocated blocks are in the correct alignment.
+    // Check that all free blocks are in the correct alignment.
     // If a free block is out of alignment, return 20.
-    // If an allocated block is out of alignment, return 25.
-
-    //check all free blocks
-    memory_block_t *block = free_head;
-    if (check_alignment(block)) {
-        return 20;
-    }
 
-    //check all allocated blocks
-    block = alloc_head;
-    if (check_alignment(block)) {
-        return 25;
+    for (int class = 0; class < NUM_SIZE_CLASSES; class++) {
+        if (check_alignment(arena->free_lists[class])) {
+            return 20;
+        }
     }
-    
 
     //HEAP CHECK #3
-    // Check that the free list is being maintained in memory 
-    // order.
-    // If a free block is out of sorted memory order in the free list,
+    // Check that every free block sits on the list of its own size class
+    // and that the list is properly doubly linked.
+    // If a block is on the wrong list or has a broken prev link,
     // return 30.
 
-    memory_block_t *prev = NULL;
-    cur = free_head;
-    while(cur) {
-        //first two statements make sure we are not comparing a memory address 
-        //to NULL in the case that there is only one block in the free list OR
-        //we are at the end of the free list
-        if(!prev && !cur && (&prev >= &cur)) {
-            return 30;
+    for (int class = 0; class < NUM_SIZE_CLASSES; class++) {
+        memory_block_t *prev = NULL;
+        for (cur = arena->free_lists[class]; cur; cur = cur->next) {
+            if (get_size_class(get_size(cur)) != class || cur->prev != prev) {
+                return 30;
+            }
+            prev = cur;
         }
-        //moves the pointers to the next pair of blocks
-        prev = cur;
-        cur = cur->next;
+    }
+
+
+    //HEAP CHECK #5
+    // Check that free blocks were coalesced with their physical neighbors
+    // and that the boundary tags agree with each other.
+    // Returns 50 if two free blocks are adjacent, 55 if a block's
+    // prev_size does not match its physical predecessor.
+    for (int class = 0; class < NUM_SIZE_CLASSES; class++) {
+        for (cur = arena->free_lists[class]; cur; cur = cur->next) {
+            memory_block_t *next = get_phys_next(cur);
+            memory_block_t *prev = get_phys_prev(cur);
+            if ((next && !is_allocated(next)) || (prev && !is_allocated(prev))) {
+                return 50;
+            }
+            if ((next && next->prev_size != get_size(cur)) ||
+                (prev && get_phys_next(prev) != cur)) {
+                return 55;
+            }
+        }
+    }
+
+
+    //HEAP CHECK #6
+    // Check that every block parked in a fast bin is still marked allocated
+    // and fast, sits in the bin for its size, and that fastbin_count matches.
+    // Returns 60 on a bad block, 65 if the count is off.
+    size_t fast_blocks = 0;
+    for (int bin = 0; bin < NUM_FASTBINS; bin++) {
+        for (cur = arena->fastbins[bin]; cur; cur = cur->next) {
+            if (!is_allocated(cur) || !is_fast(cur) ||
+                get_size(cur) != (bin + 1) * ALIGNMENT) {
+                return 60;
+            }
+            fast_blocks++;
+        }
+    }
+    if (fast_blocks != arena->fastbin_count) {
+        return 65;
+    }
+
+
+    //HEAP CHECK #7
+    // Walk every region block by block. The blocks must tile the region
+    // exactly, only the first block may be marked first, only the final
+    // block may be marked last, and each prev_size must match.
+    // If a region is broken, return 70.
+    for (heap_region_t *region = arena->regions; region; region = region->next) {
+        memory_block_t *prev = NULL;
+        cur = get_region_first(region);
+        while (cur) {
+            if ((void *) cur >= region->end || is_first(cur) != (prev == NULL) ||
+                (prev && cur->prev_size != get_size(prev))) {
+                return 70;
+            }
+            prev = cur;
+            cur = get_phys_next(cur);
+        }
+        if ((void *) prev + HEADER_SIZE + get_size(prev) != region->end) {
+            return 70;
+        }
+    }
+
+
+    //HEAP CHECK #8
+    // Check that each class's packed size index mirrors its free list:
+    // every listed block sits in the slot it records with its own size,
+    // and the index holds nothing else.
+    // If the index and the list disagree, return 80.
+    for (int class = 0; class < NUM_SIZE_CLASSES; class++) {
+        free_index_t *index = &arena->free_index[class];
+        if (index->broken) {
+            continue;
+        }
+        uint32_t listed = 0;
+        for (cur = arena->free_lists[class]; cur; cur = cur->next) {
+            uint32_t slot = index_get_slot(cur);
+            if (slot >= index->count || index->blocks[slot] != cur ||
+                index->sizes[slot] != get_size(cur)) {
+                return 80;
+            }
+            listed++;
+        }
+        if (listed != index->count) {
+            return 80;
+        }
+    }
+
+
+    return 0;
+}
+
+/*
+ * check_heap -  used to check that the heap is still in a consistent state.
+ * Required to be completed for checkpoint 1.
+ * Should return 0 if the heap is still consistent, otherwise return a non-zero
+ * return code. Asserts are also a useful tool here.
+ * Arenas are not locked, so only call this while no other thread allocates.
+ */
+int check_heap() {
+
+    // Example heap check:
+
+    //HEAP CHECKS #1, #2, #3, #5, #6, #7, #8 run on each arena
+    for (int i = 0; i < NUM_HEAPS; i++) {
+        int ret = check_arena(&arenas[i]);
+        if (ret) {
+            return ret;
+        }
+    }
+
+
+    //HEAP CHECK #2
+    // Check that all allocated blocks are in the correct alignment.
+    // If an allocated block is out of alignment, return 25.
+    memory_block_t *block = alloc_head;
+    if (check_alignment(block)) {
+        return 25;
     }
 
 
@@ -90,7 +195,7 @@ int check_heap() {
     // near the beginning or end of a block.
 
     //need two linked list pointers
-    cur = alloc_head;
+    memory_block_t *cur = alloc_head;
 
     //checks each allocated block with all other allocated blocks.
     while (cur) {
@@ -115,4 +220,4 @@ int check_heap() {
 
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,281 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * container_bench.cpp - Standard container workloads run once per allocator:
+ * std::allocator (glibc through operator new), UAllocator and the std::pmr
+ * containers over umalloc_resource. Like microbench, every run gets its own
+ * child process so the peak RSS it reports is its own.
+ *
+ *   vector  - vectors grown by push_back from empty, the realloc style
+ *             pattern of doubling buffers that are freed right after
+ *   map     - an unordered_map filled, half erased and refilled, node sized
+ *             blocks with a bucket array that is regrown as it fills
+ *   list    - a list built, thinned and refilled, one small block per node
+ *
+ * -n is the number of elements per container. umalloc can't hand out a
+ * block much past 64 KB, so it is capped where the vector buffers and the
+ * map's bucket array still fit.
+ **************************************************************************/
+
+#include "uallocator.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+using umalloc_cpp::UAllocator;
+
+#define MAX_ELEMENTS 4096
+
+/* Benchmark parameters, shared by every workload */
+typedef struct {
+    long rounds;    /* containers built and destroyed per workload */
+    int elements;   /* elements per container */
+    uint64_t seed;
+} bench_params_t;
+
+/*
+ * next_rand - xorshift64, the same generator microbench uses.
+ */
+static uint64_t next_rand(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/*
+ * run_vector - grows eight vectors side by side so their buffers interleave
+ * in the heap. Returns a checksum so the work can't be optimized out.
+ */
+template <typename Vector>
+static long run_vector(bench_params_t *params, const typename Vector::allocator_type &alloc) {
+    long sum = 0;
+    for (long round = 0; round < params->rounds; round++) {
+        std::vector<Vector> vectors(8, Vector(alloc));
+        for (int i = 0; i < params->elements; i++) {
+            for (Vector &vector : vectors) {
+                vector.push_back(i);
+            }
+        }
+        for (Vector &vector : vectors) {
+            sum += vector.back();
+        }
+    }
+    return sum;
+}
+
+/*
+ * run_map - fills a map with random keys, erases every other one and
+ * refills it, so freed nodes are handed out again.
+ */
+template <typename Map>
+static long run_map(bench_params_t *params, const typename Map::allocator_type &alloc) {
+    uint64_t state = params->seed;
+    long sum = 0;
+    for (long round = 0; round < params->rounds; round++) {
+        Map map(alloc);
+        for (int i = 0; i < params->elements; i++) {
+            map[next_rand(&state)] = i;
+        }
+        bool erase = false;
+        for (auto it = map.begin(); it != map.end(); erase = !erase) {
+            it = erase ? map.erase(it) : std::next(it);
+        }
+        for (int i = 0; i < params->elements / 2; i++) {
+            map[next_rand(&state)] = i;
+        }
+        sum += map.size();
+    }
+    return sum;
+}
+
+/*
+ * run_list - builds a list, drops a random third of it and refills it at
+ * random positions.
+ */
+template <typename List>
+static long run_list(bench_params_t *params, const typename List::allocator_type &alloc) {
+    uint64_t state = params->seed;
+    long sum = 0;
+    for (long round = 0; round < params->rounds; round++) {
+        List list(alloc);
+        for (int i = 0; i < params->elements; i++) {
+            list.push_back(i);
+        }
+        list.remove_if([&state](long) { return next_rand(&state) % 3 == 0; });
+        for (auto it = list.begin(); it != list.end(); ++it) {
+            if (next_rand(&state) % 2) {
+                list.insert(it, 0);
+            }
+        }
+        sum += list.size();
+    }
+    return sum;
+}
+
+typedef std::unordered_map<uint64_t, long> std_map_t;
+typedef std::unordered_map<uint64_t, long, std::hash<uint64_t>, std::equal_to<uint64_t>,
+                           UAllocator<std::pair<const uint64_t, long>>> umalloc_map_t;
+
+/* One workload over one allocator */
+typedef struct {
+    const char *name;
+    const char *allocator;
+    long (*run)(bench_params_t *params);
+} bench_t;
+
+static bench_t benches[] = {
+    {"vector", "std", [](bench_params_t *p) {
+        return run_vector<std::vector<long>>(p, std::allocator<long>());
+    }},
+    {"vector", "umalloc", [](bench_params_t *p) {
+        return run_vector<std::vector<long, UAllocator<long>>>(p, UAllocator<long>());
+    }},
+    {"vector", "pmr", [](bench_params_t *p) {
+        return run_vector<std::pmr::vector<long>>(p, umalloc_cpp::umalloc_resource());
+    }},
+    {"map", "std", [](bench_params_t *p) {
+        return run_map<std_map_t>(p, std_map_t::allocator_type());
+    }},
+    {"map", "umalloc", [](bench_params_t *p) {
+        return run_map<umalloc_map_t>(p, umalloc_map_t::allocator_type());
+    }},
+    {"map", "pmr", [](bench_params_t *p) {
+        return run_map<std::pmr::unordered_map<uint64_t, long>>(p, umalloc_cpp::umalloc_resource());
+    }},
+    {"list", "std", [](bench_params_t *p) {
+        return run_list<std::list<long>>(p, std::allocator<long>());
+    }},
+    {"list", "umalloc", [](bench_params_t *p) {
+        return run_list<std::list<long, UAllocator<long>>>(p, UAllocator<long>());
+    }},
+    {"list", "pmr", [](bench_params_t *p) {
+        return run_list<std::pmr::list<long>>(p, umalloc_cpp::umalloc_resource());
+    }},
+};
+#define NUM_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+/*
+ * run_bench - runs one workload in a child process and prints its line.
+ * Returns false if the workload failed.
+ */
+static bool run_bench(bench_t *bench, bench_params_t *params) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (uinit() == -1) {
+            printf("%-8s %-8s failed, uinit returned -1\n", bench->name, bench->allocator);
+            exit(1);
+        }
+        struct timespec start, end;
+        long checksum;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        try {
+            checksum = bench->run(params);
+        } catch (const std::bad_alloc &) {
+            printf("%-8s %-8s failed, out of memory\n", bench->name, bench->allocator);
+            exit(1);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        printf("%-8s %-8s %10.4f %14.0f %12ld %12ld\n", bench->name, bench->allocator, secs,
+               secs > 0 ? params->rounds / secs : 0.0, usage.ru_maxrss, checksum);
+        exit(0);
+    }
+
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+        fprintf(stderr, "Could not run the benchmark in a child process.\n");
+        exit(1);
+    }
+    if (!WIFEXITED(status)) {
+        printf("%-8s %-8s crashed\n", bench->name, bench->allocator);
+        return false;
+    }
+    return WEXITSTATUS(status) == 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: container_bench [-h] [-b bench] [-a allocator] [-n elements] [-R rounds] [-r seed]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h              Print this message.\n");
+    fprintf(stderr, "\t-b bench        Run only this workload (vector, map, list).\n");
+    fprintf(stderr, "\t-a allocator    Run only this allocator (std, umalloc, pmr).\n");
+    fprintf(stderr, "\t-n elements     Elements per container, at most %d (default 4096).\n", MAX_ELEMENTS);
+    fprintf(stderr, "\t-R rounds       Containers built per workload (default 200).\n");
+    fprintf(stderr, "\t-r seed         Random seed (default 1).\n");
+}
+
+int main(int argc, char **argv) {
+    bench_params_t params = {200, MAX_ELEMENTS, 1};
+    const char *only = NULL;
+    const char *only_allocator = NULL;
+    int c;
+
+    while ((c = getopt(argc, argv, "hb:a:n:R:r:")) != EOF) {
+        switch (c) {
+            case 'h':
+                usage();
+                exit(0);
+            case 'b':
+                only = optarg;
+                break;
+            case 'a':
+                only_allocator = optarg;
+                break;
+            case 'n':
+                params.elements = atoi(optarg);
+                break;
+            case 'R':
+                params.rounds = atol(optarg);
+                break;
+            case 'r':
+                params.seed = atol(optarg);
+                break;
+            default:
+                usage();
+                exit(1);
+        }
+    }
+    if (params.rounds <= 0 || params.elements <= 0 || params.elements > MAX_ELEMENTS) {
+        usage();
+        fprintf(stderr, "Invalid benchmark parameters.\n");
+        exit(1);
+    }
+    if (params.seed == 0) {
+        params.seed = 1; //xorshift never leaves zero
+    }
+
+    printf("%-8s %-8s %10s %14s %12s %12s\n", "bench", "alloc", "secs", "rounds/sec", "peak RSS KB",
+           "checksum");
+    bool ok = true;
+    bool found = false;
+    for (size_t i = 0; i < NUM_BENCHES; i++) {
+        if ((only && strcmp(only, benches[i].name)) ||
+            (only_allocator && strcmp(only_allocator, benches[i].allocator))) {
+            continue;
+        }
+        found = true;
+        ok &= run_bench(&benches[i], &params);
+    }
+    if (!found) {
+        usage();
+        fprintf(stderr, "Unknown benchmark or allocator.\n");
+        exit(1);
+    }
+    return ok ? 0 : 1;
+}
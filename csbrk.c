@@ -15,27 +15,42 @@
 #include <assert.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
 
 sbrk_block *sbrk_blocks = NULL;
 size_t sbrk_bytes;
 
+// The current huge page reservation chuge hands memory out of.
+static char *huge_cursor = NULL;
+static char *huge_end = NULL;
+
+// The mapped persistent heap file cpersist hands memory out of.
+static persist_header_t *persist_map = NULL;
+
 /*
- * csbrk - A wrapper for sbrk. Places a maximum on the maximum amount of memory
- * that can be requested. If tracking is enabled, keeps track of the sbrk regions
- * allocated for correctness and utilization.
+ * track_region - records memory handed to the allocator so payloads can be
+ * bounds checked and utilization measured. Only active with TRACK_CSBRK.
  */
-void *csbrk(intptr_t increment)
+static void track_region(void *ret, intptr_t increment)
 {
-    if (increment > 16 * PAGESIZE)
-    {
-        printf("%ld %d %d\n", increment, 8 * PAGESIZE, increment > 8 * PAGESIZE);
-        fprintf(stderr, "Memory request execeeds limit\n");
-        return NULL;
-    }
-
-    void *ret = sbrk(increment);
 #ifdef TRACK_CSBRK
     sbrk_bytes += increment;
+    //a shrinking break hands back the end of the region that ends at ret
+    if (increment < 0) {
+        for (sbrk_block *temp = sbrk_blocks; temp != NULL; temp = temp->next) {
+            if (temp->sbrk_end == (uint64_t)ret) {
+                temp->sbrk_end += increment;
+                break;
+            }
+        }
+        return;
+    }
     uint64_t sbrk_start_temp = (uint64_t)ret;
     uint64_t sbrk_end_temp = sbrk_start_temp + (uint64_t)increment;
     bool coalesced = false;
@@ -59,10 +74,178 @@ void *csbrk(intptr_t increment)
         sbrk_blocks = temp;
     }
 #endif
+}
+
+/*
+ * csbrk - A wrapper for sbrk. Places a maximum on the maximum amount of memory
+ * that can be requested. If tracking is enabled, keeps track of the sbrk regions
+ * allocated for correctness and utilization.
+ */
+void *csbrk(intptr_t increment)
+{
+    if (increment > 16 * PAGESIZE)
+    {
+        printf("%ld %d %d\n", increment, 8 * PAGESIZE, increment > 8 * PAGESIZE);
+        fprintf(stderr, "Memory request execeeds limit\n");
+        return NULL;
+    }
+
+    void *ret = sbrk(increment);
+    if (ret != (void *) -1) {
+        track_region(ret, increment);
+    }
 
     return ret;
 }
 
+/*
+ * reserve_huge - maps a fresh HUGE_RESERVE bytes aligned to HUGE_PAGE_SIZE
+ * and asks the kernel to back it with transparent huge pages. Memory is only
+ * committed as it is touched. Returns false if the mapping failed.
+ */
+static bool reserve_huge(void)
+{
+    size_t span = HUGE_RESERVE + HUGE_PAGE_SIZE;
+    char *map = mmap(NULL, span, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    //trim the slack so the reservation starts and ends on a huge page
+    char *start = (char *)(((uintptr_t)map + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    if (start > map) {
+        munmap(map, start - map);
+    }
+    munmap(start + HUGE_RESERVE, map + span - (start + HUGE_RESERVE));
+
+    //a kernel with THP off refuses the advice, the memory still works
+    madvise(start, HUGE_RESERVE, MADV_HUGEPAGE);
+    huge_cursor = start;
+    huge_end = start + HUGE_RESERVE;
+    return true;
+}
+
+/*
+ * chuge - A drop in for csbrk that hands out memory from 2 MB aligned,
+ * huge page backed reservations instead of the program break. Consecutive
+ * calls return contiguous memory until a reservation runs out, so the heap
+ * stays packed into as few huge pages as possible and the program's own
+ * sbrk calls never split it. Returns (void *) -1 like sbrk on failure.
+ */
+void *chuge(intptr_t increment)
+{
+    if (increment > 16 * PAGESIZE)
+    {
+        fprintf(stderr, "Memory request execeeds limit\n");
+        return NULL;
+    }
+
+    if (huge_cursor == NULL || huge_cursor + increment > huge_end) {
+        if (!reserve_huge()) {
+            return (void *) -1;
+        }
+    }
+    void *ret = huge_cursor;
+    huge_cursor += increment;
+    track_region(ret, increment);
+    return ret;
+}
+
+/*
+ * cpersist_open - opens or creates a persistent heap file and maps it shared.
+ * A new file is sized to capacity and mapped wherever the kernel likes. An
+ * existing one keeps its own capacity and is mapped back at the address
+ * recorded in its header if that is free, otherwise somewhere else, in which
+ * case the header's base no longer matches and the caller must relocate.
+ * Returns the header, or NULL if the file can't be used.
+ */
+persist_header_t *cpersist_open(const char *path, size_t capacity)
+{
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    persist_header_t header = {0};
+    void *hint = NULL;
+    int flags = MAP_SHARED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != PERSIST_MAGIC ||
+            header.version != PERSIST_VERSION || header.capacity != (uint64_t)st.st_size) {
+            fprintf(stderr, "%s is not a persistent heap\n", path);
+            close(fd);
+            return NULL;
+        }
+        capacity = header.capacity;
+        hint = (void *)header.base;
+        flags |= MAP_FIXED_NOREPLACE;
+    } else if (capacity < 2 * PAGESIZE || ftruncate(fd, capacity) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(hint, capacity, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (map == MAP_FAILED && hint) {
+        //the old base is taken, relocate
+        map = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    persist_map = map;
+    if (!hint) {
+        persist_map->magic = PERSIST_MAGIC;
+        persist_map->version = PERSIST_VERSION;
+        persist_map->base = (uint64_t)map;
+        persist_map->capacity = capacity;
+        persist_map->top = PAGESIZE;
+        persist_map->root = 0;
+    } else if (persist_map->top > PAGESIZE) {
+        track_region((char *)map + PAGESIZE, persist_map->top - PAGESIZE);
+    }
+    return persist_map;
+}
+
+/*
+ * cpersist - A drop in for csbrk that hands out memory from the mapped
+ * persistent heap file. Returns (void *) -1 like sbrk once the file is full.
+ */
+void *cpersist(intptr_t increment)
+{
+    if (increment > 16 * PAGESIZE)
+    {
+        fprintf(stderr, "Memory request execeeds limit\n");
+        return NULL;
+    }
+
+    if (persist_map == NULL || persist_map->top + increment > persist_map->capacity) {
+        return (void *) -1;
+    }
+    void *ret = (char *)persist_map + persist_map->top;
+    persist_map->top += increment;
+    track_region(ret, increment);
+    return ret;
+}
+
+/*
+ * cpersist_close - writes the persistent heap back to its file and unmaps it.
+ */
+int cpersist_close(void)
+{
+    if (persist_map == NULL) {
+        return 0;
+    }
+    size_t capacity = persist_map->capacity;
+    int err = msync(persist_map, capacity, MS_SYNC);
+    munmap(persist_map, capacity);
+    persist_map = NULL;
+    return err;
+}
+
 /*
  * check_malloc_output - Checks that a payload returned by umalloc falls within
  * one of the sbrk regions.
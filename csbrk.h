@@ -13,6 +13,10 @@
 #include <stdlib.h>
 
 #define PAGESIZE 4096
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define HUGE_RESERVE (32 * HUGE_PAGE_SIZE) /* address space chuge maps at a time */
+#define PERSIST_MAGIC 0x50434F4C4C414D55ULL /* "UMALLOCP" read little endian */
+#define PERSIST_VERSION 1
 
 typedef struct sbrk_block_struct
 {
@@ -21,5 +25,23 @@ typedef struct sbrk_block_struct
     struct sbrk_block_struct *next;
 } sbrk_block;
 
+/*
+ * persist_header_t - The first page of a persistent heap file. Everything
+ * after it is handed to umalloc by cpersist, so the file holds the heap and
+ * its boundary tags. Positions are offsets from the start of the file.
+ */
+typedef struct {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t base;     /* address the file was mapped at when last attached */
+    uint64_t capacity; /* size of the file */
+    uint64_t top;      /* one past the last byte cpersist handed out */
+    uint64_t root;     /* offset of the root object, 0 for none */
+} persist_header_t;
+
 void *csbrk(intptr_t increment);
+void *chuge(intptr_t increment);
+persist_header_t *cpersist_open(const char *path, size_t capacity);
+void *cpersist(intptr_t increment);
+int cpersist_close(void);
 int check_malloc_output(void *payload_start, size_t payload_length);
\ No newline at end of file
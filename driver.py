@@ -1,47 +1,87 @@
 #! /usr/bin/env python3
+#
+# Builds the lab, runs every trace and prints the grade. With --save the
+# per trace results, every performance sample included, are stored as a JSON
+# baseline. With --compare the results are checked against such a baseline
+# and the traces that got significantly slower or lost utilization are
+# flagged, the exit status is 1 if any were.
+import argparse
+import json
 import subprocess
 import statistics
 import os
 import math
+import tempfile
 from tabulate import tabulate
 
 utilization_target = 60.00
 performance_target = 1400
 
-def get_num_ops(trace_file):
-    f = open(trace_file, "r")
-    num_ops = int(f.readlines()[1])
-    return num_ops
+parser = argparse.ArgumentParser(description="Grade umalloc, or compare it against a stored baseline.")
+parser.add_argument("--runs", type=int, default=20, help="performance runs per trace (default 20)")
+parser.add_argument("--save", metavar="FILE", help="store the results as a baseline")
+parser.add_argument("--compare", metavar="FILE", help="flag regressions against a stored baseline")
+parser.add_argument("--alpha", type=float, default=0.01,
+                    help="significance level of the regression test (default 0.01)")
+parser.add_argument("--threshold", type=float, default=10.0,
+                    help="smallest change in percent worth flagging (default 10)")
+args = parser.parse_args()
+
+def read_json_results(path):
+    with open(path, "r") as f:
+        return [json.loads(line) for line in f if line.strip()]
+
+def run_json(command):
+    # runs a harness with -j and returns its JSON records, [] if it failed
+    with tempfile.NamedTemporaryFile(suffix=".json") as out:
+        result = subprocess.run(command[:1] + ["-j", out.name] + command[1:], universal_newlines=True,
+                                stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        if result.returncode != 0:
+            return []
+        return read_json_results(out.name)
+
+# Performance samples of the last trace run, kept for --save and --compare
+samples = {}
 
 def performance_check(trace_file):
-    N = 20
+    ops_per_ms = []
+    p50 = []
+    p99 = []
     total_time = 0
-    num_ops = get_num_ops(trace_file)
-    for i in range(0, N):
-        performance = subprocess.run(["./performance", trace_file], universal_newlines=True, stdout=subprocess.PIPE)
-        if 'Success' not in performance.stdout:
+    num_ops = 0
+    for i in range(0, args.runs):
+        records = run_json(["./performance", trace_file])
+        if not records:
             return -1
-        total_time += int(performance.stdout.split()[1])
-    return (num_ops / (total_time // N)) * 1000
+        total_time += records[0]["us"]
+        num_ops = records[0]["ops"]
+        ops_per_ms += [records[0]["ops_per_ms"]]
+        p50 += [records[0]["latency_ns"]["p50"]]
+        p99 += [records[0]["latency_ns"]["p99"]]
+    samples[trace_file] = {"ops_per_ms": ops_per_ms, "p50_ns": p50, "p99_ns": p99}
+    return (num_ops / (total_time // args.runs)) * 1000
 
 def utilization_check(trace_file):
-    utilization = subprocess.run(["./runner", '-ru', trace_file], universal_newlines=True, stdout=subprocess.PIPE,stderr=subprocess.PIPE)
-    if utilization.returncode != 0:
+    records = run_json(["./runner", '-r', trace_file])
+    if not records or not records[0]["passed"]:
         return -1
-    return_array = utilization.stdout.split('\n')
-    utilization_percentage = float(return_array[4].split()[3])
-    return utilization_percentage
+    return records[0]["utilization"]
+
+def utilization_bound(trace_file):
+    records = run_json(["./trace_stats", '-s', trace_file])
+    if not records:
+        return -1
+    return records[0]["best_utilization"]
 
 def correctness_check(trace_file):
-    correctness = subprocess.run(["./runner", '-r', trace_file], universal_newlines=True, stdout=subprocess.PIPE,stderr=subprocess.PIPE)
-    if correctness.returncode != 0:
-        return False
-    return 'umalloc package passed correctness check.' in correctness.stdout
+    records = run_json(["./runner", '-r', trace_file])
+    return bool(records) and records[0]["passed"]
 
 trace_correctness = []
 trace_utilization = []
 trace_performance = []
 table = []
+results = {}  # per trace results, what --save stores
 
 def run_trace(trace_file):
     global trace_correctness
@@ -58,7 +98,83 @@ def run_trace(trace_file):
         trace_utilization += [util]
         trace_performance += [perf]
     correct = 'Yes' if passed else 'No' 
-    table += [[trace_file, correct, util, perf]]
+    table += [[trace_file, correct, util, utilization_bound(trace_file), perf]]
+    results[trace_file] = dict(samples.get(trace_file, {}), passed=passed, utilization=util)
+
+def mann_whitney_greater(a, b):
+    # one sided p-value of the samples in a tending to be larger than those
+    # in b, from the normal approximation of the rank sum test with ties
+    n1, n2 = len(a), len(b)
+    if n1 == 0 or n2 == 0:
+        return 1.0
+    values = sorted([(v, 0) for v in a] + [(v, 1) for v in b])
+    n = n1 + n2
+    rank_sum = 0.0
+    ties = 0.0
+    i = 0
+    while i < n:
+        j = i
+        while j < n and values[j][0] == values[i][0]:
+            j += 1
+        rank = (i + j + 1) / 2  # ranks i + 1 to j share their average
+        rank_sum += rank * sum(1 for k in range(i, j) if values[k][1] == 0)
+        ties += (j - i) ** 3 - (j - i)
+        i = j
+    u = rank_sum - n1 * (n1 + 1) / 2
+    sigma = math.sqrt(n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1))))
+    if sigma == 0:
+        return 1.0
+    z = (u - n1 * n2 / 2 - 0.5) / sigma
+    return 0.5 * math.erfc(z / math.sqrt(2))
+
+def relative_change(old, new):
+    return 100.0 * (new - old) / old if old else 0.0
+
+def compare_trace(trace_file, base, now):
+    # returns the table row for one trace and whether it regressed
+    if not now["passed"]:
+        return [trace_file, "FAILS", "", "", "", "REGRESSION"], True
+    if not base["passed"]:
+        return [trace_file, "now passes", "", "", "", ""], False
+    flags = []
+    util_change = now["utilization"] - base["utilization"]
+    if util_change < -0.005:
+        flags += ["utilization"]
+    if not base.get("ops_per_ms") or not now.get("ops_per_ms"):
+        row = [trace_file, "Yes", "{:+.2f}".format(util_change), "n/a", "n/a",
+               "REGRESSION: " + ", ".join(flags) if flags else ""]
+        return row, bool(flags)
+
+    # medians are what is compared, the test guards against noise
+    ops_change = relative_change(statistics.median(base["ops_per_ms"]), statistics.median(now["ops_per_ms"]))
+    ops_p = mann_whitney_greater(base["ops_per_ms"], now["ops_per_ms"])
+    if ops_p < args.alpha and ops_change < -args.threshold:
+        flags += ["throughput"]
+    p99_change = relative_change(statistics.median(base["p99_ns"]), statistics.median(now["p99_ns"]))
+    p99_p = mann_whitney_greater(now["p99_ns"], base["p99_ns"])
+    if p99_p < args.alpha and p99_change > args.threshold:
+        flags += ["p99 latency"]
+
+    row = [trace_file, "Yes", "{:+.2f}".format(util_change), "{:+.1f}% (p={:.3f})".format(ops_change, ops_p),
+           "{:+.1f}% (p={:.3f})".format(p99_change, p99_p), "REGRESSION: " + ", ".join(flags) if flags else ""]
+    return row, bool(flags)
+
+def compare_baseline(path):
+    with open(path, "r") as f:
+        baseline = json.load(f)["traces"]
+    rows = []
+    regressed = False
+    for trace_file in sorted(results):
+        if trace_file not in baseline:
+            rows += [[trace_file, "not in baseline", "", "", "", ""]]
+            continue
+        row, worse = compare_trace(trace_file, baseline[trace_file], results[trace_file])
+        rows += [row]
+        regressed |= worse
+    print()
+    print(tabulate(rows, headers=["Trace", "Passed", "Utilization", "Throughput", "p99 latency", ""]))
+    return regressed
+
 
 os.system("make clean; make all")
 for file in os.listdir("./traces"):
@@ -67,8 +183,8 @@ for file in os.listdir("./traces"):
 utilization_average = sum(trace_utilization) / (1 if len(trace_utilization) == 0 else len(trace_utilization))
 performance_average = sum(trace_performance) / (1 if len(trace_performance) == 0 else len(trace_performance))
 correctness_average = sum(trace_correctness) / (1 if len(trace_correctness) == 0 else len(trace_correctness))
-table += [["Average", "{:.2f}".format(correctness_average * 100), "{:.2f}".format(utilization_average), "{:.2f}".format(performance_average)]]
-print (tabulate(table, headers=["Trace", "Passed", "Utilization", "Performance (Operations per millisecond)"]))
+table += [["Average", "{:.2f}".format(correctness_average * 100), "{:.2f}".format(utilization_average), "", "{:.2f}".format(performance_average)]]
+print (tabulate(table, headers=["Trace", "Passed", "Utilization", "Best possible", "Performance (Operations per millisecond)"]))
 
 # Score calculation
 utilization_score = 50 * (utilization_average / utilization_target)
@@ -91,3 +207,10 @@ print (f"Correct: {correctness_score}/20, perf: {performance_score}/20, util: {u
 print ("Score " + str(math.ceil(correctness_score + ((performance_score + utilization_score) * scale_factor))) + " / 90")
 print ("The other ten points come from the style check, after the assignment is turned in")
 
+if args.save:
+    with open(args.save, "w") as f:
+        json.dump({"runs": args.runs, "traces": results}, f, indent=1)
+    print ("Baseline saved to " + args.save)
+if args.compare and compare_baseline(args.compare):
+    exit(1)
+
@@ -0,0 +1,252 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * free_index.c - Packed free block size index and its best fit searches.
+ * Each size class list is mirrored by a dense array of sizes so find can
+ * compare four (SSE2) or eight (AVX2) candidates per instruction instead of
+ * chasing next pointers into scattered free blocks.
+ *
+ * Sizes are kept as 32 bit payload sizes. Blocks never get near 2 GB, so
+ * the SIMD searches may use signed compares.
+ **************************************************************************/
+
+#define _GNU_SOURCE
+#include "umalloc.h"
+#include <assert.h>
+#include <sys/mman.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
+
+#define INDEX_MIN_CAPACITY 256
+#define NO_FIT INT32_MAX
+
+/*
+ * get_slot_word - the first payload word of a free block holds its slot.
+ */
+static uint32_t *get_slot_word(memory_block_t *block) {
+    return (uint32_t *) get_payload(block);
+}
+
+uint32_t index_get_slot(memory_block_t *block) {
+    return *get_slot_word(block);
+}
+
+/*
+ * grow_array - maps or remaps one of the index arrays to hold capacity
+ * entries of size bytes. Returns NULL if the kernel refused.
+ */
+static void *grow_array(void *array, size_t old_capacity, size_t capacity, size_t size) {
+    void *grown;
+    if (!array) {
+        grown = mmap(NULL, capacity * size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    } else {
+        grown = mremap(array, old_capacity * size, capacity * size, MREMAP_MAYMOVE);
+    }
+    return grown == MAP_FAILED ? NULL : grown;
+}
+
+/*
+ * index_insert - adds a free block to the end of the index. If the arrays
+ * can't grow the index is marked broken and ignored until the arena resets.
+ */
+void index_insert(free_index_t *index, memory_block_t *block) {
+    if (index->broken) {
+        return;
+    }
+    if (index->count == index->capacity) {
+        uint32_t capacity = index->capacity ? index->capacity * 2 : INDEX_MIN_CAPACITY;
+        uint32_t *sizes = grow_array(index->sizes, index->capacity, capacity, sizeof(uint32_t));
+        memory_block_t **blocks = NULL;
+        if (sizes) {
+            index->sizes = sizes;
+            blocks = grow_array(index->blocks, index->capacity, capacity, sizeof(memory_block_t *));
+        }
+        if (!blocks) {
+            //the sizes array may already be bigger, keep its old capacity
+            //so a later mremap still names the right length
+            index->broken = true;
+            return;
+        }
+        index->blocks = blocks;
+        index->capacity = capacity;
+    }
+
+    assert(get_size(block) < NO_FIT);
+    uint32_t slot = index->count++;
+    index->sizes[slot] = get_size(block);
+    index->blocks[slot] = block;
+    *get_slot_word(block) = slot;
+}
+
+/*
+ * index_remove - drops a free block from the index by moving the last slot
+ * into its place.
+ */
+void index_remove(free_index_t *index, memory_block_t *block) {
+    if (index->broken) {
+        return;
+    }
+    uint32_t slot = *get_slot_word(block);
+    assert(slot < index->count && index->blocks[slot] == block);
+
+    uint32_t last = --index->count;
+    if (slot != last) {
+        index->sizes[slot] = index->sizes[last];
+        index->blocks[slot] = index->blocks[last];
+        *get_slot_word(index->blocks[slot]) = slot;
+    }
+}
+
+/*
+ * best_fit_scalar - the smallest size >= want, stopping at an exact fit.
+ * Returns the slot or -1.
+ */
+static int64_t best_fit_scalar(const uint32_t *sizes, uint32_t count, uint32_t want) {
+    int64_t best = -1;
+    uint32_t best_size = NO_FIT;
+    for (uint32_t i = 0; i < count; i++) {
+        if (sizes[i] >= want && sizes[i] < best_size) {
+            best = i;
+            best_size = sizes[i];
+            if (best_size == want) {
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+/*
+ * find_size - the first slot at or after start holding size.
+ */
+static int64_t find_size(const uint32_t *sizes, uint32_t count, uint32_t start, uint32_t size) {
+    for (uint32_t i = start; i < count; i++) {
+        if (sizes[i] == size) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * best_fit_sse2 - four sizes per compare. Sizes that don't fit are replaced
+ * by NO_FIT and a running minimum is kept per lane, an exact fit ends the
+ * scan at once. SSE2 has no 32 bit min, so it is built from a compare and
+ * a blend.
+ */
+static int64_t best_fit_sse2(const uint32_t *sizes, uint32_t count, uint32_t want) {
+    const __m128i below = _mm_set1_epi32(want - 1);
+    const __m128i exact = _mm_set1_epi32(want);
+    const __m128i no_fit = _mm_set1_epi32(NO_FIT);
+    __m128i best = no_fit;
+
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (sizes + i));
+        int hit = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, exact)));
+        if (hit) {
+            return i + __builtin_ctz(hit);
+        }
+        __m128i fits = _mm_cmpgt_epi32(v, below);
+        __m128i cand = _mm_or_si128(_mm_and_si128(fits, v), _mm_andnot_si128(fits, no_fit));
+        __m128i smaller = _mm_cmplt_epi32(cand, best);
+        best = _mm_or_si128(_mm_and_si128(smaller, cand), _mm_andnot_si128(smaller, best));
+    }
+
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i *) lanes, best);
+    uint32_t best_size = NO_FIT;
+    for (int lane = 0; lane < 4; lane++) {
+        best_size = lanes[lane] < best_size ? lanes[lane] : best_size;
+    }
+    int64_t tail = best_fit_scalar(sizes + i, count - i, want);
+    if (tail >= 0 && sizes[i + tail] <= best_size) {
+        return i + tail;
+    }
+    return best_size == NO_FIT ? -1 : find_size(sizes, i, 0, best_size);
+}
+
+/*
+ * best_fit_avx2 - the same search eight sizes at a time, AVX2 has a native
+ * 32 bit min. Only called when the CPU reports AVX2.
+ */
+__attribute__((target("avx2")))
+static int64_t best_fit_avx2(const uint32_t *sizes, uint32_t count, uint32_t want) {
+    const __m256i below = _mm256_set1_epi32(want - 1);
+    const __m256i exact = _mm256_set1_epi32(want);
+    const __m256i no_fit = _mm256_set1_epi32(NO_FIT);
+    __m256i best = no_fit;
+
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (sizes + i));
+        int hit = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, exact)));
+        if (hit) {
+            return i + __builtin_ctz(hit);
+        }
+        __m256i fits = _mm256_cmpgt_epi32(v, below);
+        best = _mm256_min_epi32(best, _mm256_blendv_epi8(no_fit, v, fits));
+    }
+
+    uint32_t lanes[8];
+    _mm256_storeu_si256((__m256i *) lanes, best);
+    uint32_t best_size = NO_FIT;
+    for (int lane = 0; lane < 8; lane++) {
+        best_size = lanes[lane] < best_size ? lanes[lane] : best_size;
+    }
+    int64_t tail = best_fit_scalar(sizes + i, count - i, want);
+    if (tail >= 0 && sizes[i + tail] <= best_size) {
+        return i + tail;
+    }
+    return best_size == NO_FIT ? -1 : find_size(sizes, i, 0, best_size);
+}
+#endif
+
+/*
+ * resolve_free_search - turns FREE_SEARCH_AUTO, or a search this CPU can't
+ * run, into the best one it can.
+ */
+free_search_t resolve_free_search(free_search_t search) {
+#ifdef HAVE_X86_SIMD
+    bool avx2 = __builtin_cpu_supports("avx2");
+    if (search == FREE_SEARCH_AUTO || (search == FREE_SEARCH_AVX2 && !avx2)) {
+        return avx2 ? FREE_SEARCH_AVX2 : FREE_SEARCH_SSE2;
+    }
+    return search;
+#else
+    return search == FREE_SEARCH_LIST ? FREE_SEARCH_LIST : FREE_SEARCH_SCALAR;
+#endif
+}
+
+const char *free_search_name(free_search_t search) {
+    static const char *names[] = {"auto", "list", "scalar", "sse2", "avx2"};
+    return names[search];
+}
+
+/*
+ * index_best_fit - the slot of the smallest indexed block with at least size
+ * bytes of payload, or -1 if none fits. search must be resolved and must not
+ * be FREE_SEARCH_LIST.
+ */
+int64_t index_best_fit(free_index_t *index, size_t size, free_search_t search) {
+    //every indexed size is below NO_FIT, and a larger size would not survive
+    //the narrowing to the index's 32-bit lanes
+    if (size >= NO_FIT) {
+        return -1;
+    }
+    uint32_t want = size;
+    switch (search) {
+#ifdef HAVE_X86_SIMD
+        case FREE_SEARCH_AVX2:
+            return best_fit_avx2(index->sizes, index->count, want);
+        case FREE_SEARCH_SSE2:
+            return best_fit_sse2(index->sizes, index->count, want);
+#endif
+        default:
+            return best_fit_scalar(index->sizes, index->count, want);
+    }
+}
@@ -0,0 +1,207 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * gen_size_classes.c - Reads a corpus of traces and generates size_classes.h,
+ * the constant tables umalloc uses to map a request size to a size class.
+ *
+ * Usage: gen_size_classes [-n classes] [-m lookup_max] [-o header] trace...
+ **************************************************************************/
+
+#include "umalloc.h"
+#include "csbrk.h"
+#include "support.h"
+
+#define DEFAULT_CLASSES 16
+#define DEFAULT_LOOKUP_MAX 1024
+#define MAX_CLASSES 64
+#define SLAB_BLOCKS 32 /* blocks of the largest size in a class per slab */
+#define MAX_SLAB_PAGES 16 /* csbrk refuses anything larger */
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: gen_size_classes [-h] [-n classes] [-m lookup_max] [-o header] trace...\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-n         Number of size classes (default %d).\n", DEFAULT_CLASSES);
+    fprintf(stderr, "\t-m         Largest size served by the lookup table (default %d).\n", DEFAULT_LOOKUP_MAX);
+    fprintf(stderr, "\t-o         Output header (default stdout).\n");
+}
+
+/*
+ * pick_bounds - Splits the requests at or below lookup_max into num_classes - 1
+ * classes holding roughly the same number of requests each. Popular sizes end
+ * up in a class of their own. The final class holds everything larger than
+ * lookup_max. Returns the number of classes actually used.
+ */
+static int pick_bounds(size_t *hist, size_t lookup_max, int num_classes, size_t *bounds) {
+    size_t slots = lookup_max / ALIGNMENT;
+    size_t total = 0;
+    for (size_t i = 1; i <= slots; i++) {
+        total += hist[i];
+    }
+
+    int small_classes = num_classes - 1;
+    int used = 0;
+    size_t seen = 0;
+    for (size_t i = 1; i <= slots && used < small_classes - 1; i++) {
+        seen += hist[i];
+        //close the class once it holds its share of the requests
+        if (hist[i] && seen * small_classes >= total * (used + 1)) {
+            bounds[used++] = i * ALIGNMENT;
+        }
+    }
+    //the last small class always ends at lookup_max so that every size past
+    //the lookup table belongs to the final class
+    if (used == 0 || bounds[used - 1] != lookup_max) {
+        bounds[used++] = lookup_max;
+    }
+    bounds[used++] = SIZE_MAX;
+    return used;
+}
+
+/*
+ * slab_size - Bytes umalloc requests from csbrk when a class runs dry. Enough
+ * for SLAB_BLOCKS of the largest block in the class, rounded up to a page.
+ * The final class is unbounded and always extends by exactly what it needs.
+ */
+static size_t slab_size(size_t bound) {
+    if (bound == SIZE_MAX) {
+        return 0;
+    }
+    size_t bytes = SLAB_BLOCKS * (bound + HEADER_SIZE);
+    size_t pages = (bytes + PAGESIZE - 1) / PAGESIZE;
+    if (pages > MAX_SLAB_PAGES) {
+        pages = MAX_SLAB_PAGES;
+    }
+    return pages * PAGESIZE;
+}
+
+/*
+ * emit_header - Writes the generated tables out as a C header.
+ */
+static void emit_header(FILE *out, int argc, char **argv, int first_trace, size_t *bounds,
+                        int num_classes, size_t lookup_max) {
+    fprintf(out, "/* Generated by gen_size_classes from:\n");
+    for (int i = first_trace; i < argc; i++) {
+        fprintf(out, " *   %s\n", argv[i]);
+    }
+    fprintf(out, " * Do not edit by hand, run `make classes` instead.\n */\n\n");
+    fprintf(out, "#ifndef SIZE_CLASSES_H\n#define SIZE_CLASSES_H\n\n");
+    fprintf(out, "#include <stddef.h>\n#include <stdint.h>\n\n");
+    fprintf(out, "#define NUM_SIZE_CLASSES %d\n", num_classes);
+    fprintf(out, "#define SIZE_CLASS_LOOKUP_MAX %lu\n\n", lookup_max);
+
+    fprintf(out, "/* Largest payload held by each class, the last class is unbounded */\n");
+    fprintf(out, "static const size_t size_class_bounds[NUM_SIZE_CLASSES] = {\n");
+    for (int c = 0; c < num_classes; c++) {
+        if (bounds[c] == SIZE_MAX) {
+            fprintf(out, "    SIZE_MAX,\n");
+        } else {
+            fprintf(out, "    %lu,\n", bounds[c]);
+        }
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "/* Bytes to request from csbrk when a class has no fit, 0 means exact */\n");
+    fprintf(out, "static const size_t size_class_slab_sizes[NUM_SIZE_CLASSES] = {\n");
+    for (int c = 0; c < num_classes; c++) {
+        fprintf(out, "    %lu,\n", slab_size(bounds[c]));
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "/* Size class of every aligned size up to SIZE_CLASS_LOOKUP_MAX, indexed by\n");
+    fprintf(out, " * size / ALIGNMENT. Larger sizes clamp to the last entry. */\n");
+    fprintf(out, "static const uint8_t size_class_lookup[SIZE_CLASS_LOOKUP_MAX / %d + 2] = {", ALIGNMENT);
+    int c = 0;
+    size_t slots = lookup_max / ALIGNMENT;
+    for (size_t i = 0; i <= slots + 1; i++) {
+        size_t size = i * ALIGNMENT;
+        while (size > bounds[c]) {
+            c++;
+        }
+        if (i % 16 == 0) {
+            fprintf(out, "\n   ");
+        }
+        fprintf(out, " %d,", c);
+    }
+    fprintf(out, "\n};\n\n#endif /* SIZE_CLASSES_H */\n");
+}
+
+int main(int argc, char **argv) {
+    char c;
+    int num_classes = DEFAULT_CLASSES;
+    size_t lookup_max = DEFAULT_LOOKUP_MAX;
+    char *out_file = NULL;
+
+    while ((c = getopt(argc, argv, "hn:m:o:")) != EOF) {
+        switch (c) {
+        case 'n':
+            num_classes = atoi(optarg);
+            break;
+        case 'm':
+            lookup_max = ALIGN(strtoul(optarg, NULL, 10));
+            break;
+        case 'o':
+            out_file = optarg;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+
+    if (optind >= argc) {
+        usage();
+        appl_error("Missing trace parameters.");
+    }
+    if (num_classes < 2 || num_classes > MAX_CLASSES) {
+        appl_error("Number of classes must be between 2 and 64.");
+    }
+    if (lookup_max < ALIGNMENT) {
+        appl_error("Lookup max must be at least ALIGNMENT.");
+    }
+
+    //hist[i] counts requests of aligned size i * ALIGNMENT, the last slot
+    //collects everything larger than lookup_max
+    size_t slots = lookup_max / ALIGNMENT;
+    size_t *hist = calloc(slots + 2, sizeof(size_t));
+    if (hist == NULL) {
+        appl_error("Failed to allocate histogram");
+    }
+
+    for (int i = optind; i < argc; i++) {
+        trace_t *trace = read_trace(argv[i], 0);
+        for (int op = 0; op < trace->num_ops; op++) {
+            if (trace->ops[op].type == FREE) {
+                continue;
+            }
+            size_t slot = ALIGN((size_t) trace->ops[op].size) / ALIGNMENT;
+            if (slot == 0) {
+                slot = 1;
+            }
+            hist[slot > slots ? slots + 1 : slot]++;
+        }
+        free_trace(trace);
+    }
+
+    size_t bounds[MAX_CLASSES];
+    int used = pick_bounds(hist, lookup_max, num_classes, bounds);
+
+    FILE *out = stdout;
+    if (out_file && (out = fopen(out_file, "w")) == NULL) {
+        sprintf(msg, "Could not open %s for writing", out_file);
+        appl_error(msg);
+    }
+    emit_header(out, argc, argv, optind, bounds, used, lookup_max);
+    if (out != stdout) {
+        fclose(out);
+    }
+    free(hist);
+    return 0;
+}
@@ -0,0 +1,88 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * heapmap.c - Dumps a physical map of every block in the heap as CSV, one
+ * row per block, so fragmentation can be inspected with heapviz.py.
+ *
+ * Each row is: op,arena,offset,size,state,overhead
+ *   op       - the trace op the snapshot was taken after
+ *   arena    - index of the arena owning the block
+ *   offset   - byte offset of the block from the lowest region in the heap
+ *   size     - payload bytes of the block
+ *   state    - alloc, free, parked (sitting in a fast bin, thread cache or
+ *              remote free stack) or region (a region header)
+ *   overhead - header bytes spent on the block
+ **************************************************************************/
+
+#include "umalloc.h"
+#include "heapmap.h"
+
+extern heap_arena_t arenas[NUM_HEAPS];
+
+/*
+ * heap_base - returns the lowest region start across all arenas. The heap
+ * only grows upward, so the base stays put across snapshots.
+ */
+static void *heap_base() {
+    void *base = NULL;
+    for (int i = 0; i < NUM_HEAPS; i++) {
+        for (heap_region_t *region = arenas[i].regions; region; region = region->next) {
+            if (!base || (void *) region < base) {
+                base = region;
+            }
+        }
+    }
+    return base;
+}
+
+/*
+ * block_state - names the state of a block for the map.
+ */
+static const char *block_state(memory_block_t *block) {
+    if (!is_allocated(block)) {
+        return "free";
+    }
+    //an allocated block handed to the user always carries the magic number
+    void *magic = block->next;
+    bool handed_out = magic == MAGIC_NUM || magic == MAGIC_NUM_SAMPLED || magic == MAGIC_NUM_TRACKED;
+    return handed_out ? "alloc" : "parked";
+}
+
+/*
+ * write_heap_map_header - writes the CSV column names.
+ */
+void write_heap_map_header(FILE *out) {
+    fprintf(out, "op,arena,offset,size,state,overhead\n");
+}
+
+/*
+ * write_heap_map - walks every region of every arena block by block and
+ * writes one row per block. Arenas are not locked, so only call this while
+ * no other thread allocates. Returns the number of rows written, or -1 if a
+ * region does not end on a block boundary.
+ */
+int write_heap_map(FILE *out, long op) {
+    char *base = heap_base();
+    int rows = 0;
+
+    for (int i = 0; i < NUM_HEAPS; i++) {
+        for (heap_region_t *region = arenas[i].regions; region; region = region->next) {
+            fprintf(out, "%ld,%d,%ld,%d,region,%d\n", op, i, (char *) region - base, 0,
+                    REGION_HEADER_SIZE);
+            rows++;
+
+            memory_block_t *block = get_region_first(region);
+            while (block) {
+                fprintf(out, "%ld,%d,%ld,%lu,%s,%d\n", op, i, (char *) block - base,
+                        get_size(block), block_state(block), HEADER_SIZE);
+                rows++;
+                if (is_last(block) &&
+                    (void *) block + HEADER_SIZE + get_size(block) != region->end) {
+                    return -1;
+                }
+                block = get_phys_next(block);
+            }
+        }
+    }
+    return rows;
+}
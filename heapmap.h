@@ -0,0 +1,11 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * heapmap.h - Dumps a physical map of every block in the heap as CSV, one
+ * row per block, so fragmentation can be inspected with heapviz.py.
+ **************************************************************************/
+
+#include <stdio.h>
+
+void write_heap_map_header(FILE *out);
+int write_heap_map(FILE *out, long op);
@@ -0,0 +1,377 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * heapprof.c - A sampling heap profiler. Roughly one allocation per sample
+ * interval bytes is recorded with its backtrace, and the samples can be
+ * written as a pprof heap profile or as folded stacks for flame graphs.
+ *
+ * umalloc keeps a per thread countdown of bytes and only calls in here when
+ * it runs out, so unsampled allocations pay a single decrement. Sampled
+ * blocks are tagged in their header so ufree only looks them up here.
+ *
+ * Set UMALLOC_HEAPPROF=prefix to profile any program that calls uinit, the
+ * profiles are written to prefix.<pid>.heap, prefix.<pid>.live.folded and
+ * prefix.<pid>.alloc.folded when it exits. UMALLOC_HEAPPROF_RATE overrides
+ * the mean sample interval in bytes. Link with -rdynamic to get names for
+ * exported functions in the folded stacks, other frames are module+offset.
+ **************************************************************************/
+
+#define _GNU_SOURCE
+#include "heapprof.h"
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HEAPPROF_DEPTH 32          /* frames kept per stack */
+#define HEAPPROF_STACK_BUCKETS 4096
+#define HEAPPROF_OBJECT_BUCKETS 16384
+#define HEAPPROF_IDLE_CHECK (1 << 20) /* bytes between checks while stopped */
+
+/* Samples that share a call stack, the counts are raw sampled numbers */
+typedef struct heapprof_stack {
+    struct heapprof_stack *next;
+    uint64_t hash;
+    int depth;
+    void *pcs[HEAPPROF_DEPTH];
+    uint64_t live_count;
+    uint64_t live_bytes;
+    uint64_t total_count;
+    uint64_t total_bytes;
+} heapprof_stack_t;
+
+/* A sampled block that has not been freed yet */
+typedef struct heapprof_object {
+    struct heapprof_object *next;
+    void *ptr;
+    size_t size;
+    heapprof_stack_t *stack;
+} heapprof_object_t;
+
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic bool active = false;
+static size_t sample_rate = HEAPPROF_DEFAULT_RATE;
+static heapprof_stack_t *stacks[HEAPPROF_STACK_BUCKETS];
+static heapprof_object_t *objects[HEAPPROF_OBJECT_BUCKETS];
+static heapprof_object_t *spare_objects; // freed object records, reused
+static char *env_prefix;
+
+static __thread uint64_t rand_state;
+
+/*
+ * next_rand - xorshift64, seeded per thread on first use.
+ */
+static uint64_t next_rand(void) {
+    if (rand_state == 0) {
+        rand_state = (uintptr_t) &rand_state ^ (uint64_t) time(NULL) << 20 ^ 0x9e3779b97f4a7c15ull;
+    }
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+/*
+ * heapprof_next_sample - bytes until the thread's next sample. Drawn from an
+ * exponential distribution so samples form a Poisson process over allocated
+ * bytes, which is what pprof assumes when it scales the profile back up.
+ */
+int64_t heapprof_next_sample(void) {
+    if (!active) {
+        return HEAPPROF_IDLE_CHECK;
+    }
+    double u = ((next_rand() >> 11) + 1) * (1.0 / 9007199254740992.0);
+    return (int64_t) (-log(u) * sample_rate) + 1;
+}
+
+static uint64_t hash_pcs(void **pcs, int depth) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int i = 0; i < depth; i++) {
+        hash = (hash ^ (uintptr_t) pcs[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static size_t hash_ptr(void *ptr) {
+    return ((uintptr_t) ptr >> 4) * 0x9e3779b97f4a7c15ull >> 50 & (HEAPPROF_OBJECT_BUCKETS - 1);
+}
+
+/*
+ * find_stack - returns the entry for a stack, adding it if new. Called with
+ * prof_lock held.
+ */
+static heapprof_stack_t *find_stack(void **pcs, int depth) {
+    uint64_t hash = hash_pcs(pcs, depth);
+    heapprof_stack_t **bucket = &stacks[hash % HEAPPROF_STACK_BUCKETS];
+    for (heapprof_stack_t *stack = *bucket; stack; stack = stack->next) {
+        if (stack->hash == hash && stack->depth == depth &&
+            !memcmp(stack->pcs, pcs, depth * sizeof(void *))) {
+            return stack;
+        }
+    }
+    heapprof_stack_t *stack = calloc(1, sizeof(heapprof_stack_t));
+    if (!stack) {
+        return NULL;
+    }
+    stack->hash = hash;
+    stack->depth = depth;
+    memcpy(stack->pcs, pcs, depth * sizeof(void *));
+    stack->next = *bucket;
+    *bucket = stack;
+    return stack;
+}
+
+/*
+ * heapprof_record - records a sampled allocation of size bytes at ptr. The
+ * stack is cut at caller, the return address into the allocating code, so
+ * the allocator's own frames stay out of the profile. Returns true if the
+ * sample was kept and ufree must call heapprof_forget for it.
+ */
+bool heapprof_record(void *ptr, size_t size, void *caller) {
+    if (!active) {
+        return false;
+    }
+
+    void *pcs[HEAPPROF_DEPTH + 8];
+    int depth = backtrace(pcs, HEAPPROF_DEPTH + 8);
+    int skip = 0;
+    while (skip < depth && pcs[skip] != caller) {
+        skip++;
+    }
+    if (skip == depth) {
+        skip = 0; //caller not found, keep everything rather than nothing
+    }
+    depth -= skip;
+    if (depth > HEAPPROF_DEPTH) {
+        depth = HEAPPROF_DEPTH;
+    }
+
+    pthread_mutex_lock(&prof_lock);
+    heapprof_stack_t *stack = find_stack(pcs + skip, depth);
+    heapprof_object_t *object = spare_objects;
+    if (object) {
+        spare_objects = object->next;
+    } else {
+        object = malloc(sizeof(heapprof_object_t));
+    }
+    if (!stack || !object) {
+        free(object);
+        pthread_mutex_unlock(&prof_lock);
+        return false;
+    }
+    stack->live_count++;
+    stack->live_bytes += size;
+    stack->total_count++;
+    stack->total_bytes += size;
+
+    object->ptr = ptr;
+    object->size = size;
+    object->stack = stack;
+    heapprof_object_t **bucket = &objects[hash_ptr(ptr)];
+    object->next = *bucket;
+    *bucket = object;
+    pthread_mutex_unlock(&prof_lock);
+    return true;
+}
+
+/*
+ * heapprof_forget - drops a sampled block from the live profile when it is
+ * freed. Its bytes stay in the cumulative profile.
+ */
+void heapprof_forget(void *ptr) {
+    pthread_mutex_lock(&prof_lock);
+    for (heapprof_object_t **link = &objects[hash_ptr(ptr)]; *link; link = &(*link)->next) {
+        heapprof_object_t *object = *link;
+        if (object->ptr == ptr) {
+            object->stack->live_count--;
+            object->stack->live_bytes -= object->size;
+            *link = object->next;
+            object->next = spare_objects;
+            spare_objects = object;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&prof_lock);
+}
+
+/*
+ * heapprof_reset_live - forgets every live sample, uinit calls this because
+ * it throws the whole heap away.
+ */
+void heapprof_reset_live(void) {
+    pthread_mutex_lock(&prof_lock);
+    for (int i = 0; i < HEAPPROF_OBJECT_BUCKETS; i++) {
+        while (objects[i]) {
+            heapprof_object_t *object = objects[i];
+            object->stack->live_count--;
+            object->stack->live_bytes -= object->size;
+            objects[i] = object->next;
+            object->next = spare_objects;
+            spare_objects = object;
+        }
+    }
+    pthread_mutex_unlock(&prof_lock);
+}
+
+/*
+ * heapprof_start - starts sampling about once every rate bytes.
+ */
+void heapprof_start(size_t rate) {
+    sample_rate = rate ? rate : HEAPPROF_DEFAULT_RATE;
+    active = true;
+}
+
+/*
+ * heapprof_stop - stops taking new samples, the collected ones are kept.
+ */
+void heapprof_stop(void) {
+    active = false;
+}
+
+/*
+ * unsample - estimated real bytes behind a stack's sampled bytes. An object
+ * of size s is sampled with probability 1 - e^(-s/rate).
+ */
+static double unsample(uint64_t count, uint64_t bytes) {
+    if (count == 0) {
+        return 0;
+    }
+    double avg = (double) bytes / count;
+    return bytes / (1 - exp(-avg / sample_rate));
+}
+
+/*
+ * heapprof_write_pprof - writes the profile in the legacy heap profile text
+ * format that pprof reads, with raw sampled counts that pprof scales back up
+ * using the heap_v2 rate. Returns the number of stacks written.
+ */
+int heapprof_write_pprof(FILE *out) {
+    uint64_t live_count = 0, live_bytes = 0, total_count = 0, total_bytes = 0;
+    pthread_mutex_lock(&prof_lock);
+    for (int i = 0; i < HEAPPROF_STACK_BUCKETS; i++) {
+        for (heapprof_stack_t *stack = stacks[i]; stack; stack = stack->next) {
+            live_count += stack->live_count;
+            live_bytes += stack->live_bytes;
+            total_count += stack->total_count;
+            total_bytes += stack->total_bytes;
+        }
+    }
+    fprintf(out, "heap profile: %lu: %lu [%lu: %lu] @ heap_v2/%lu\n", live_count, live_bytes,
+            total_count, total_bytes, sample_rate);
+
+    int written = 0;
+    for (int i = 0; i < HEAPPROF_STACK_BUCKETS; i++) {
+        for (heapprof_stack_t *stack = stacks[i]; stack; stack = stack->next) {
+            fprintf(out, "%lu: %lu [%lu: %lu] @", stack->live_count, stack->live_bytes,
+                    stack->total_count, stack->total_bytes);
+            for (int f = 0; f < stack->depth; f++) {
+                fprintf(out, " %p", stack->pcs[f]);
+            }
+            fprintf(out, "\n");
+            written++;
+        }
+    }
+    pthread_mutex_unlock(&prof_lock);
+
+    //pprof symbolizes the addresses against the mappings
+    fprintf(out, "\nMAPPED_LIBRARIES:\n");
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (maps) {
+        char line[512];
+        while (fgets(line, sizeof(line), maps)) {
+            fputs(line, out);
+        }
+        fclose(maps);
+    }
+    return written;
+}
+
+/*
+ * write_frame - writes one frame of a folded stack, by name if it can be
+ * resolved and as module+offset otherwise.
+ */
+static void write_frame(FILE *out, void *pc) {
+    Dl_info info;
+    bool found = dladdr(pc, &info);
+    if (found && info.dli_sname) {
+        fprintf(out, "%s", info.dli_sname);
+    } else if (found && info.dli_fname) {
+        const char *base = strrchr(info.dli_fname, '/');
+        fprintf(out, "%s+%#lx", base ? base + 1 : info.dli_fname,
+                (uintptr_t) pc - (uintptr_t) info.dli_fbase);
+    } else {
+        fprintf(out, "%p", pc);
+    }
+}
+
+/*
+ * heapprof_write_folded - writes one line per stack, root first and frames
+ * separated by ';', followed by the estimated live (or cumulative) bytes.
+ * This is the input flamegraph.pl expects. Returns the number of stacks written.
+ */
+int heapprof_write_folded(FILE *out, bool live) {
+    int written = 0;
+    pthread_mutex_lock(&prof_lock);
+    for (int i = 0; i < HEAPPROF_STACK_BUCKETS; i++) {
+        for (heapprof_stack_t *stack = stacks[i]; stack; stack = stack->next) {
+            double bytes = live ? unsample(stack->live_count, stack->live_bytes)
+                                : unsample(stack->total_count, stack->total_bytes);
+            if (bytes == 0) {
+                continue;
+            }
+            for (int f = stack->depth - 1; f >= 0; f--) {
+                write_frame(out, stack->pcs[f]);
+                fprintf(out, f ? ";" : " ");
+            }
+            fprintf(out, "%.0f\n", bytes);
+            written++;
+        }
+    }
+    pthread_mutex_unlock(&prof_lock);
+    return written;
+}
+
+/*
+ * write_env_profiles - atexit hook that writes the profiles asked for by
+ * UMALLOC_HEAPPROF.
+ */
+static void write_env_profiles(void) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.%d.heap", env_prefix, getpid());
+    FILE *out = fopen(path, "w");
+    if (out) {
+        heapprof_write_pprof(out);
+        fclose(out);
+    }
+    for (int live = 0; live < 2; live++) {
+        snprintf(path, sizeof(path), "%s.%d.%s.folded", env_prefix, getpid(), live ? "live" : "alloc");
+        out = fopen(path, "w");
+        if (out) {
+            heapprof_write_folded(out, live);
+            fclose(out);
+        }
+    }
+}
+
+static void init_from_env(void) {
+    env_prefix = getenv("UMALLOC_HEAPPROF");
+    if (!env_prefix || !*env_prefix) {
+        return;
+    }
+    char *rate = getenv("UMALLOC_HEAPPROF_RATE");
+    heapprof_start(rate ? strtoul(rate, NULL, 10) : HEAPPROF_DEFAULT_RATE);
+    atexit(write_env_profiles);
+}
+
+/*
+ * heapprof_init_from_env - starts the profiler if UMALLOC_HEAPPROF is set.
+ * Only the first call does anything.
+ */
+void heapprof_init_from_env(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, init_from_env);
+}
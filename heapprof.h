@@ -0,0 +1,27 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * heapprof.h - A sampling heap profiler. Roughly one allocation per sample
+ * interval bytes is recorded with its backtrace, and the samples can be
+ * written as a pprof heap profile or as folded stacks for flame graphs.
+ **************************************************************************/
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define HEAPPROF_DEFAULT_RATE (512 * 1024) /* mean bytes between samples */
+
+void heapprof_start(size_t rate);
+void heapprof_stop(void);
+void heapprof_init_from_env(void);
+
+// Called by umalloc, only once the thread's sample countdown runs out
+int64_t heapprof_next_sample(void);
+bool heapprof_record(void *ptr, size_t size, void *caller);
+void heapprof_forget(void *ptr);
+void heapprof_reset_live(void);
+
+int heapprof_write_pprof(FILE *out);
+int heapprof_write_folded(FILE *out, bool live);
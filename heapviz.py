@@ -0,0 +1,104 @@
+#! /usr/bin/env python3
+# Turns heap map snapshots written by `./runner -m n` (or the runner's
+# interactive `map` command) into a fragmentation-over-time view.
+#
+# For every snapshot it prints the heap span, allocated and free bytes,
+# the number of free holes, the largest hole and the external
+# fragmentation (1 - largest hole / free bytes), followed by a strip of
+# the address space: '#' allocated, '+' parked in a bin or cache,
+# '.' free, '-' header overhead, ' ' not part of the heap.
+# With --svg the same strips are drawn one row per snapshot.
+import argparse
+import csv
+from collections import OrderedDict
+
+STRIP_CHARS = {'alloc': '#', 'parked': '+', 'free': '.', 'region': '-'}
+SVG_COLORS = {'alloc': '#c0392b', 'parked': '#e67e22', 'free': '#27ae60', 'region': '#7f8c8d'}
+
+def read_snapshots(path):
+    snapshots = OrderedDict()
+    with open(path) as f:
+        for row in csv.DictReader(f):
+            block = (int(row['offset']), int(row['size']), row['state'], int(row['overhead']))
+            snapshots.setdefault(int(row['op']), []).append(block)
+    return snapshots
+
+def heap_span(snapshots):
+    return max(offset + overhead + size
+               for blocks in snapshots.values()
+               for offset, size, state, overhead in blocks)
+
+def stats(blocks):
+    holes = [size for offset, size, state, overhead in blocks if state == 'free']
+    allocated = sum(size for offset, size, state, overhead in blocks if state == 'alloc')
+    parked = sum(size for offset, size, state, overhead in blocks if state == 'parked')
+    overhead = sum(overhead for offset, size, state, overhead in blocks)
+    free = sum(holes)
+    largest = max(holes) if holes else 0
+    frag = 1 - largest / free if free else 0.0
+    return {'allocated': allocated, 'parked': parked, 'free': free, 'overhead': overhead,
+            'holes': len(holes), 'largest': largest, 'frag': frag}
+
+def strip(blocks, span, width):
+    cells = [' '] * width
+    scale = span / width
+    for offset, size, state, overhead in blocks:
+        # header first, then the payload in the block's own state
+        for start, length, ch in ((offset, overhead, '-'),
+                                  (offset + overhead, size, STRIP_CHARS[state])):
+            if length == 0:
+                continue
+            first = int(start / scale)
+            last = max(first, int((start + length - 1) / scale))
+            for cell in range(first, min(last, width - 1) + 1):
+                # a free byte never hides an allocated one in the same cell
+                if cells[cell] in (' ', '-', '.') or ch in ('#', '+'):
+                    cells[cell] = ch
+    return ''.join(cells)
+
+def write_svg(path, snapshots, span, width, row_height):
+    rows = len(snapshots)
+    scale = width / span
+    with open(path, 'w') as f:
+        f.write(f'<svg xmlns="http://www.w3.org/2000/svg" width="{width + 80}" '
+                f'height="{rows * row_height}">\n')
+        for row, (op, blocks) in enumerate(snapshots.items()):
+            y = row * row_height
+            f.write(f'<text x="0" y="{y + row_height - 2}" font-size="{row_height - 2}">{op}</text>\n')
+            for offset, size, state, overhead in blocks:
+                x = 80 + (offset + overhead) * scale
+                w = max(size * scale, 0.5)
+                if size:
+                    f.write(f'<rect x="{x:.2f}" y="{y}" width="{w:.2f}" height="{row_height - 1}" '
+                            f'fill="{SVG_COLORS[state]}"/>\n')
+        f.write('</svg>\n')
+
+def main():
+    parser = argparse.ArgumentParser(description='Fragmentation over time from heap map snapshots.')
+    parser.add_argument('map', help='CSV written by runner -m')
+    parser.add_argument('-w', '--width', type=int, default=100, help='characters per strip')
+    parser.add_argument('-q', '--quiet', action='store_true', help='only print the table')
+    parser.add_argument('--svg', help='also draw the snapshots to this SVG file')
+    args = parser.parse_args()
+
+    snapshots = read_snapshots(args.map)
+    if not snapshots:
+        print('No snapshots in ' + args.map)
+        return
+    span = heap_span(snapshots)
+
+    print(f'{"op":>8} {"span":>9} {"alloc":>9} {"parked":>8} {"free":>9} {"holes":>6} {"largest":>8} {"frag":>6}')
+    for op, blocks in snapshots.items():
+        s = stats(blocks)
+        used = max(offset + overhead + size for offset, size, state, overhead in blocks)
+        print(f'{op:>8} {used:>9} {s["allocated"]:>9} {s["parked"]:>8} {s["free"]:>9} '
+              f'{s["holes"]:>6} {s["largest"]:>8} {s["frag"]:>6.2f}')
+        if not args.quiet:
+            print('         |' + strip(blocks, span, args.width) + '|')
+
+    if args.svg:
+        write_svg(args.svg, snapshots, span, args.width * 8, 12)
+        print('Wrote ' + args.svg)
+
+if __name__ == '__main__':
+    main()
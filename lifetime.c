@@ -0,0 +1,175 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * lifetime.c - Predicts whether an allocation will be short-lived from its
+ * call site and size class. One allocation in LIFETIME_SAMPLE is followed
+ * until it is freed, and votes short if that took fewer than
+ * LIFETIME_SHORT_ALLOCS allocations. Followed objects that outlive the
+ * bound are swept up and vote long without waiting for their free.
+ *
+ * Followed blocks are tagged MAGIC_NUM_TRACKED in their header, so ufree
+ * only looks up the blocks that are or were followed. Only the thread that
+ * owns the pointer writes the tag, so a swept block keeps it and its free
+ * just finds nothing to forget. Time is counted in followed allocations, so
+ * the clock costs nothing on the fast path.
+ **************************************************************************/
+
+#include "umalloc.h"
+#include <string.h>
+
+#define LIFETIME_SITES 4096   /* predictor entries, direct mapped on site and class */
+#define LIFETIME_OBJECTS 4096 /* followed objects at once */
+#define LIFETIME_PROBE 8      /* slots looked at for a followed object */
+#define LIFETIME_MIN_VOTES 4  /* votes a site needs before it is predicted */
+#define LIFETIME_MAX_VOTES 64 /* votes are halved past this, so sites can change */
+#define LIFETIME_SHORT_TICKS (LIFETIME_SHORT_ALLOCS / LIFETIME_SAMPLE)
+
+/* What has been seen of one call site and size class */
+typedef struct {
+    uintptr_t key; //0 for an unused entry
+    uint16_t short_votes;
+    uint16_t long_votes;
+} lifetime_site_t;
+
+/* An object being followed to its free */
+typedef struct {
+    void *ptr; //NULL for a free slot
+    lifetime_site_t *site;
+    uintptr_t key; //the site's key when the object was born
+    uint64_t born;
+} lifetime_object_t;
+
+// Guards everything below. Only followed allocations and their frees take
+// it, predictions read the site table without it, so the site fields are
+// stored with relaxed atomics.
+static pthread_mutex_t lifetime_lock = PTHREAD_MUTEX_INITIALIZER;
+static lifetime_site_t sites[LIFETIME_SITES];
+static lifetime_object_t objects[LIFETIME_OBJECTS];
+static uint64_t clock_ticks = 0; //followed allocations so far
+static uint64_t next_sweep = LIFETIME_SHORT_TICKS;
+
+static uintptr_t site_key(void *site, int size_class) {
+    return ((uintptr_t) site ^ ((uintptr_t) size_class << 56)) | 1;
+}
+
+static size_t hash_key(uintptr_t key, size_t buckets) {
+    return (key >> 4) * 0x9e3779b97f4a7c15ull >> 40 & (buckets - 1);
+}
+
+/*
+ * vote - adds one observed lifetime to the counts of the object's site.
+ */
+static void vote(lifetime_object_t *object, bool short_lived) {
+    lifetime_site_t *site = object->site;
+    if (site->key != object->key) {
+        return; //the entry was taken over by another site meanwhile
+    }
+    uint16_t short_votes = site->short_votes + short_lived;
+    uint16_t long_votes = site->long_votes + !short_lived;
+    if (short_votes + long_votes > LIFETIME_MAX_VOTES) {
+        short_votes /= 2;
+        long_votes /= 2;
+    }
+    __atomic_store_n(&site->short_votes, short_votes, __ATOMIC_RELAXED);
+    __atomic_store_n(&site->long_votes, long_votes, __ATOMIC_RELAXED);
+}
+
+/*
+ * sweep - every followed object that has outlived the short bound votes
+ * long and is let go. Their blocks may belong to other threads, so their
+ * tags are left for ufree. Caller holds lifetime_lock.
+ */
+static void sweep() {
+    for (int i = 0; i < LIFETIME_OBJECTS; i++) {
+        lifetime_object_t *object = &objects[i];
+        if (object->ptr && clock_ticks - object->born >= LIFETIME_SHORT_TICKS) {
+            vote(object, false);
+            object->ptr = NULL;
+        }
+    }
+    next_sweep = clock_ticks + LIFETIME_SHORT_TICKS;
+}
+
+/*
+ * lifetime_predict - LIFETIME_SHORT if most objects seen from site in this
+ * size class died young, otherwise LIFETIME_LONG. Reads the table without
+ * the lock, counts from mid-update only cost one prediction.
+ */
+lifetime_t lifetime_predict(void *site, int size_class) {
+    uintptr_t key = site_key(site, size_class);
+    lifetime_site_t *entry = &sites[hash_key(key, LIFETIME_SITES)];
+    uint16_t short_votes = __atomic_load_n(&entry->short_votes, __ATOMIC_RELAXED);
+    uint16_t long_votes = __atomic_load_n(&entry->long_votes, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&entry->key, __ATOMIC_RELAXED) != key ||
+        short_votes + long_votes < LIFETIME_MIN_VOTES) {
+        return LIFETIME_LONG;
+    }
+    return short_votes > 3 * long_votes ? LIFETIME_SHORT : LIFETIME_LONG;
+}
+
+/*
+ * lifetime_track - starts following a new object at ptr. Returns true if
+ * it is followed, the caller then tags its block MAGIC_NUM_TRACKED.
+ */
+bool lifetime_track(void *ptr, void *site, int size_class) {
+    uintptr_t key = site_key(site, size_class);
+    pthread_mutex_lock(&lifetime_lock);
+    if (++clock_ticks >= next_sweep) {
+        sweep();
+    }
+
+    lifetime_site_t *entry = &sites[hash_key(key, LIFETIME_SITES)];
+    if (entry->key != key) {
+        __atomic_store_n(&entry->key, key, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->short_votes, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->long_votes, 0, __ATOMIC_RELAXED);
+    }
+
+    size_t start = hash_key((uintptr_t) ptr, LIFETIME_OBJECTS);
+    for (int i = 0; i < LIFETIME_PROBE; i++) {
+        lifetime_object_t *object = &objects[(start + i) & (LIFETIME_OBJECTS - 1)];
+        if (!object->ptr) {
+            object->ptr = ptr;
+            object->site = entry;
+            object->key = key;
+            object->born = clock_ticks;
+            pthread_mutex_unlock(&lifetime_lock);
+            return true;
+        }
+    }
+    pthread_mutex_unlock(&lifetime_lock);
+    return false;
+}
+
+/*
+ * lifetime_forget - stops following the object at ptr. An object that is
+ * being freed votes on its site, one that only moves (urealloc) does not.
+ */
+void lifetime_forget(void *ptr, bool freed) {
+    pthread_mutex_lock(&lifetime_lock);
+    size_t start = hash_key((uintptr_t) ptr, LIFETIME_OBJECTS);
+    for (int i = 0; i < LIFETIME_PROBE; i++) {
+        lifetime_object_t *object = &objects[(start + i) & (LIFETIME_OBJECTS - 1)];
+        if (object->ptr == ptr) {
+            if (freed) {
+                vote(object, clock_ticks - object->born < LIFETIME_SHORT_TICKS);
+            }
+            object->ptr = NULL;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lifetime_lock);
+}
+
+/*
+ * lifetime_reset - forgets the followed objects and everything learned,
+ * uinit calls this because it throws the whole heap away.
+ */
+void lifetime_reset() {
+    pthread_mutex_lock(&lifetime_lock);
+    memset(sites, 0, sizeof(sites));
+    memset(objects, 0, sizeof(objects));
+    clock_ticks = 0;
+    next_sweep = LIFETIME_SHORT_TICKS;
+    pthread_mutex_unlock(&lifetime_lock);
+}
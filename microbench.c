@@ -0,0 +1,711 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * microbench.c - Synthetic allocator stress tests that complement trace
+ * replay. Each benchmark runs in its own child process so the peak RSS and
+ * heap growth it reports belong to that benchmark alone.
+ *
+ *   pingpong - alloc/free of one size in a loop, the cached fast path
+ *   churn    - random sizes into a fixed set of live slots, find/split/coalesce
+ *   larson   - threads replace random objects and hand them to a neighbour,
+ *              the arena, thread cache and remote free paths
+ *   list     - build a linked list then free it in order, extend and the
+ *              coalescing of long runs of neighbours
+ *   longtail - mostly small sizes with a heavy tail of large ones, extend
+ *              and the last size class
+ *   request  - per request objects freed together, once through umalloc and
+ *              ufree and once through a uarena that is reset per request
+ *   fragment - many large free blocks kept apart by small pinned ones, the
+ *              best fit search over the last size class
+ *   restart  - a linked index built in a persistent heap file, then attached
+ *              again the way a restarted process would
+ *   compact  - handle objects with every other one freed, then compacted in
+ *              bounded steps, slide_down and trimming the break
+ *   ipc      - a producer process builds messages in a shared heap and
+ *              passes their offsets over a pipe to a consumer that frees
+ *              them, ushared_alloc and ushared_free from two processes
+ *
+ * -S picks how find searches the free lists, so the fragment numbers can be
+ * compared across the list walk and the scalar and SIMD index searches.
+ **************************************************************************/
+
+#include "umalloc.h"
+#include "support.h"
+#include <getopt.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* Benchmark parameters, shared by every benchmark that uses them */
+typedef struct {
+    long ops;       /* allocator calls per benchmark */
+    size_t size;    /* fixed size for pingpong and list */
+    size_t min;     /* smallest random size */
+    size_t max;     /* largest random size */
+    int live;       /* live slots for churn, larson and longtail */
+    int threads;    /* threads for larson */
+    uint64_t seed;
+    free_search_t search;
+} bench_params_t;
+
+typedef struct {
+    const char *name;
+    long (*run)(bench_params_t *params); /* returns allocator calls made, -1 on failure */
+} bench_t;
+
+/*
+ * next_rand - xorshift64, cheap enough not to show up next to the allocator.
+ */
+static uint64_t next_rand(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/*
+ * rand_size - a uniform size in [min, max].
+ */
+static size_t rand_size(uint64_t *state, size_t min, size_t max) {
+    return min + next_rand(state) % (max - min + 1);
+}
+
+/*
+ * bench_alloc - umalloc that writes the first word, so the payload counts
+ * towards RSS the way it would in a real program.
+ */
+static void *bench_alloc(size_t size) {
+    void *ptr = umalloc(size);
+    if (ptr) {
+        *(uint64_t *) ptr = size;
+    }
+    return ptr;
+}
+
+static long run_pingpong(bench_params_t *params) {
+    for (long i = 0; i < params->ops / 2; i++) {
+        void *ptr = bench_alloc(params->size);
+        if (!ptr) {
+            return -1;
+        }
+        ufree(ptr);
+    }
+    return params->ops / 2 * 2;
+}
+
+/*
+ * replace_random - frees a random slot if it is live, otherwise fills it
+ * with a random size. Returns false if umalloc failed.
+ */
+static bool replace_random(void **slots, int live, uint64_t *state, size_t min, size_t max) {
+    int slot = next_rand(state) % live;
+    if (slots[slot]) {
+        ufree(slots[slot]);
+        slots[slot] = NULL;
+        return true;
+    }
+    slots[slot] = bench_alloc(rand_size(state, min, max));
+    return slots[slot] != NULL;
+}
+
+/*
+ * free_slots - frees every live slot, returning the number of calls made.
+ */
+static long free_slots(void **slots, int live) {
+    long calls = 0;
+    for (int i = 0; i < live; i++) {
+        if (slots[i]) {
+            ufree(slots[i]);
+            slots[i] = NULL;
+            calls++;
+        }
+    }
+    return calls;
+}
+
+static long run_churn(bench_params_t *params) {
+    void **slots = calloc(params->live, sizeof(void *));
+    uint64_t state = params->seed;
+    for (long i = 0; i < params->ops; i++) {
+        if (!replace_random(slots, params->live, &state, params->min, params->max)) {
+            return -1;
+        }
+    }
+    long calls = params->ops + free_slots(slots, params->live);
+    free(slots);
+    return calls;
+}
+
+#define LARSON_ROUNDS 16
+
+/* Shared state of a larson run, each thread owns one slot array per round */
+typedef struct {
+    bench_params_t *params;
+    void ***slots;            /* slot array per thread */
+    pthread_barrier_t barrier;
+    _Atomic bool failed;
+} larson_t;
+
+typedef struct {
+    larson_t *larson;
+    int id;
+} larson_thread_t;
+
+/*
+ * larson_worker - replaces random objects in its slot array, then waits for
+ * every thread and takes over its neighbour's array, so the next round frees
+ * objects another thread (and usually another arena) allocated.
+ */
+static void *larson_worker(void *arg) {
+    larson_thread_t *self = arg;
+    larson_t *larson = self->larson;
+    bench_params_t *params = larson->params;
+    uint64_t state = params->seed + self->id * 0x9e3779b97f4a7c15ull;
+    long ops = params->ops / params->threads / LARSON_ROUNDS;
+
+    for (int round = 0; round < LARSON_ROUNDS; round++) {
+        void **slots = larson->slots[(self->id + round) % params->threads];
+        for (long i = 0; i < ops && !larson->failed; i++) {
+            if (!replace_random(slots, params->live, &state, params->min, params->max)) {
+                larson->failed = true;
+            }
+        }
+        pthread_barrier_wait(&larson->barrier);
+    }
+    return NULL;
+}
+
+static long run_larson(bench_params_t *params) {
+    larson_t larson = {.params = params, .failed = false};
+    larson.slots = malloc(params->threads * sizeof(void **));
+    for (int i = 0; i < params->threads; i++) {
+        larson.slots[i] = calloc(params->live, sizeof(void *));
+    }
+    pthread_barrier_init(&larson.barrier, NULL, params->threads);
+
+    pthread_t *tids = malloc(params->threads * sizeof(pthread_t));
+    larson_thread_t *args = malloc(params->threads * sizeof(larson_thread_t));
+    for (int i = 0; i < params->threads; i++) {
+        args[i] = (larson_thread_t) {&larson, i};
+        pthread_create(&tids[i], NULL, larson_worker, &args[i]);
+    }
+    for (int i = 0; i < params->threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    long calls = params->ops / params->threads / LARSON_ROUNDS * LARSON_ROUNDS * params->threads;
+    for (int i = 0; i < params->threads; i++) {
+        calls += free_slots(larson.slots[i], params->live);
+        free(larson.slots[i]);
+    }
+    pthread_barrier_destroy(&larson.barrier);
+    free(larson.slots);
+    free(tids);
+    free(args);
+    return larson.failed ? -1 : calls;
+}
+
+/* A list node, the payload follows the link */
+typedef struct list_node {
+    struct list_node *next;
+} list_node_t;
+
+static long run_list(bench_params_t *params) {
+    size_t size = params->size < sizeof(list_node_t) ? sizeof(list_node_t) : params->size;
+    long length = params->live;
+    long rounds = params->ops / (2 * length);
+
+    for (long round = 0; round < rounds; round++) {
+        list_node_t *head = NULL;
+        list_node_t **tail = &head;
+        for (long i = 0; i < length; i++) {
+            list_node_t *node = umalloc(size);
+            if (!node) {
+                return -1;
+            }
+            node->next = NULL;
+            *tail = node;
+            tail = &node->next;
+        }
+        //teardown in build order, each free lands next to the previous one
+        while (head) {
+            list_node_t *next = head->next;
+            ufree(head);
+            head = next;
+        }
+    }
+    return rounds * 2 * length;
+}
+
+/*
+ * tail_size - 90% of sizes in [min, 128], 9% up to 4096 and 1% up to max.
+ */
+static size_t tail_size(uint64_t *state, bench_params_t *params) {
+    int pick = next_rand(state) % 100;
+    size_t small = params->min < 128 ? params->min : 128;
+    if (pick < 90 || params->max <= 128) {
+        return rand_size(state, small, 128);
+    }
+    if (pick < 99 || params->max <= 4096) {
+        return rand_size(state, 129, params->max < 4096 ? params->max : 4096);
+    }
+    return rand_size(state, 4097, params->max);
+}
+
+static long run_longtail(bench_params_t *params) {
+    void **slots = calloc(params->live, sizeof(void *));
+    uint64_t state = params->seed;
+    for (long i = 0; i < params->ops; i++) {
+        int slot = next_rand(&state) % params->live;
+        if (slots[slot]) {
+            ufree(slots[slot]);
+        }
+        slots[slot] = bench_alloc(tail_size(&state, params));
+        if (!slots[slot]) {
+            return -1;
+        }
+    }
+    long calls = params->ops * 2 + free_slots(slots, params->live);
+    free(slots);
+    return calls;
+}
+
+/*
+ * run_request - live objects of random sizes per request, all dropped when
+ * the request ends. Runs the rounds with umalloc/ufree and then with a
+ * uarena, printing each half's time so the two can be compared.
+ */
+static long run_request(bench_params_t *params) {
+    void **slots = calloc(params->live, sizeof(void *));
+    long rounds = params->ops / (2 * params->live);
+    uint64_t state = params->seed;
+    struct timespec start, mid, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long round = 0; round < rounds; round++) {
+        for (int i = 0; i < params->live; i++) {
+            if (!(slots[i] = bench_alloc(rand_size(&state, params->min, params->max)))) {
+                return -1;
+            }
+        }
+        free_slots(slots, params->live);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &mid);
+
+    state = params->seed;
+    uarena_t *arena = uarena_create();
+    for (long round = 0; round < rounds; round++) {
+        for (int i = 0; i < params->live; i++) {
+            uint64_t *obj = uarena_alloc(arena, rand_size(&state, params->min, params->max));
+            if (!obj) {
+                return -1;
+            }
+            *obj = i;
+        }
+        uarena_reset(arena);
+    }
+    uarena_destroy(arena);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("%-10s umalloc %.4fs, uarena %.4fs\n", "request",
+           (mid.tv_sec - start.tv_sec) + (mid.tv_nsec - start.tv_nsec) / 1e9,
+           (end.tv_sec - mid.tv_sec) + (end.tv_nsec - mid.tv_nsec) / 1e9);
+    free(slots);
+    return rounds * 3 * params->live; //uarena objects are never freed one by one
+}
+
+/*
+ * run_fragment - allocates live large blocks each followed by a small pinned
+ * one, frees the large ones, and then allocates and frees random large sizes.
+ * The pins stop coalescing, so every request searches live free blocks.
+ * A request past 4 GB between the two has to fail cleanly.
+ */
+static long run_fragment(bench_params_t *params) {
+    void **pins = calloc(params->live, sizeof(void *));
+    void **holes = calloc(params->live, sizeof(void *));
+    size_t min = params->min > 1100 ? params->min : 1100; //above the last class boundary
+    size_t max = params->max > min ? params->max : min;
+    uint64_t state = params->seed;
+
+    for (int i = 0; i < params->live; i++) {
+        holes[i] = bench_alloc(rand_size(&state, min, max));
+        pins[i] = bench_alloc(16);
+        if (!holes[i] || !pins[i]) {
+            return -1;
+        }
+    }
+    free_slots(holes, params->live);
+    //too big for the free index's 32-bit sizes, it must miss rather than wrap
+    if (umalloc((size_t) UINT32_MAX + 17)) {
+        return -1;
+    }
+
+    long rounds = params->ops / 2;
+    for (long i = 0; i < rounds; i++) {
+        void *ptr = bench_alloc(rand_size(&state, min, max));
+        if (!ptr) {
+            return -1;
+        }
+        ufree(ptr);
+    }
+    long calls = params->live * 3 + 1 + rounds * 2 + free_slots(pins, params->live);
+    free(holes);
+    free(pins);
+    return calls;
+}
+
+/*
+ * run_restart - builds a list of ops / 2 nodes in a persistent heap and
+ * closes it, then reattaches and walks the list from the root. Prints the
+ * time to build, to attach and to walk so a warm restart can be compared
+ * with building again.
+ */
+static long run_restart(bench_params_t *params) {
+    char path[] = "/tmp/umalloc-restart-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return -1;
+    }
+    close(fd);
+
+    size_t size = params->size < sizeof(list_node_t) ? sizeof(list_node_t) : params->size;
+    long length = params->ops / 2;
+    struct timespec start, built, attached, walked;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    umalloc_persist(path, PERSIST_DEFAULT_CAPACITY);
+    if (uinit() != 0) {
+        return -1;
+    }
+    list_node_t *head = NULL;
+    for (long i = 0; i < length; i++) {
+        list_node_t *node = umalloc(size);
+        if (!node) {
+            return -1;
+        }
+        node->next = head;
+        head = node;
+    }
+    upersist_set_root(head);
+    upersist_close();
+    clock_gettime(CLOCK_MONOTONIC, &built);
+
+    umalloc_persist(path, 0);
+    int err = uinit();
+    clock_gettime(CLOCK_MONOTONIC, &attached);
+    long found = 0;
+    for (list_node_t *node = upersist_get_root(); !err && node; node = node->next) {
+        found++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &walked);
+    upersist_close();
+    unlink(path);
+
+    printf("%-10s build %.4fs, attach %.4fs, walk %.4fs\n", "restart",
+           (built.tv_sec - start.tv_sec) + (built.tv_nsec - start.tv_nsec) / 1e9,
+           (attached.tv_sec - built.tv_sec) + (attached.tv_nsec - built.tv_nsec) / 1e9,
+           (walked.tv_sec - attached.tv_sec) + (walked.tv_nsec - attached.tv_nsec) / 1e9);
+    return found == length ? length : -1;
+}
+
+/*
+ * run_compact - allocates live handle objects of random sizes, frees a
+ * random half and compacts the heap in steps of COMPACT_BUDGET bytes.
+ * Prints the heap before and after and the longest step, then checks every
+ * surviving object still holds its own index.
+ */
+#define COMPACT_BUDGET 65536
+static long run_compact(bench_params_t *params) {
+    uhandle_t *handles = calloc(params->live, sizeof(uhandle_t));
+    uint64_t state = params->seed;
+    long calls = 0;
+    void *heap_start = sbrk(0);
+
+    for (long round = 0; round < params->ops / (2 * params->live); round++) {
+        for (int i = 0; i < params->live; i++) {
+            if (!(handles[i] = uhandle_alloc(rand_size(&state, params->min, params->max)))) {
+                return -1;
+            }
+            *(long *) uhandle_pin(handles[i]) = i;
+            uhandle_unpin(handles[i]);
+        }
+        for (int i = 0; i < params->live; i++) {
+            if (next_rand(&state) % 2) {
+                uhandle_free(handles[i]);
+                handles[i] = UHANDLE_NULL;
+            }
+        }
+        calls += params->live * 2;
+
+        long before = ((char *) sbrk(0) - (char *) heap_start) / 1024;
+        long steps = 0;
+        double longest = 0;
+        bool more = true;
+        while (more) {
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            more = uhandle_compact(COMPACT_BUDGET);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            longest = secs > longest ? secs : longest;
+            steps++;
+        }
+        long after = ((char *) sbrk(0) - (char *) heap_start) / 1024;
+        if (round == 0) {
+            printf("%-10s heap %ld KB -> %ld KB in %ld steps, longest step %.1f us\n", "compact",
+                   before, after, steps, longest * 1e6);
+        }
+
+        for (int i = 0; i < params->live; i++) {
+            if (handles[i]) {
+                long found = *(long *) uhandle_pin(handles[i]);
+                uhandle_unpin(handles[i]);
+                uhandle_free(handles[i]);
+                if (found != i) {
+                    return -1;
+                }
+            }
+        }
+        calls += steps;
+    }
+    free(handles);
+    return calls;
+}
+
+/*
+ * run_ipc - forks a consumer and sends it ops / 2 messages of random sizes
+ * built in a shared heap, each as its offset over a pipe. The consumer
+ * checks each message's first and last word and frees it. A full heap makes
+ * the producer wait for the consumer to catch up. Then a child exits holding
+ * the heap's lock, and the next alloc has to recover the heap.
+ */
+#define IPC_CAPACITY (64UL * 1024 * 1024)
+static long run_ipc(bench_params_t *params) {
+    ushared_t *heap = ushared_create(NULL, IPC_CAPACITY);
+    int fds[2];
+    if (!heap || pipe(fds) != 0) {
+        return -1;
+    }
+    long messages = params->ops / 2;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[1]);
+        uint64_t offset;
+        long received = 0;
+        while (read(fds[0], &offset, sizeof(offset)) == sizeof(offset)) {
+            uint64_t *words = ushared_ptr(heap, offset);
+            size_t count = words[0] / sizeof(uint64_t);
+            if (words[count - 1] != offset) {
+                exit(1);
+            }
+            ushared_free(heap, offset);
+            received++;
+        }
+        exit(received == messages ? 0 : 1);
+    }
+    close(fds[0]);
+
+    uint64_t state = params->seed;
+    int status;
+    bool reaped = false;
+    for (long i = 0; pid > 0 && !reaped && i < messages; i++) {
+        size_t size = rand_size(&state, params->min, params->max) & ~(sizeof(uint64_t) - 1);
+        size = size < 2 * sizeof(uint64_t) ? 2 * sizeof(uint64_t) : size;
+        uint64_t offset;
+        while (!(offset = ushared_alloc(heap, size))) {
+            //a consumer that gave up will never make room
+            if ((reaped = waitpid(pid, &status, WNOHANG) == pid)) {
+                break;
+            }
+            sched_yield();
+        }
+        if (reaped) {
+            break;
+        }
+        uint64_t *words = ushared_ptr(heap, offset);
+        words[0] = size;
+        words[size / sizeof(uint64_t) - 1] = offset;
+        if (write(fds[1], &offset, sizeof(offset)) != sizeof(offset)) {
+            break;
+        }
+    }
+    close(fds[1]);
+
+    bool ok = pid > 0 && (reaped || waitpid(pid, &status, 0) == pid) && WIFEXITED(status) &&
+              WEXITSTATUS(status) == 0;
+    ok = ok && ushared_check(heap) == 0;
+
+    //a process that dies holding the lock must not take the heap with it
+    pid_t holder = fork();
+    if (holder == 0) {
+        _exit(ushared_lock(heap) == 0 ? 0 : 1);
+    }
+    ok = ok && holder > 0 && waitpid(holder, &status, 0) == holder && WIFEXITED(status) &&
+         WEXITSTATUS(status) == 0;
+    uint64_t offset = ok ? ushared_alloc(heap, params->min) : 0;
+    ok = ok && offset && ushared_recoveries(heap) == 1;
+    if (offset) {
+        ushared_free(heap, offset);
+    }
+    ok = ok && ushared_check(heap) == 0;
+    ushared_close(heap);
+    return ok ? messages * 2 : -1;
+}
+
+static bench_t benches[] = {
+    {"pingpong", run_pingpong},
+    {"churn", run_churn},
+    {"larson", run_larson},
+    {"list", run_list},
+    {"longtail", run_longtail},
+    {"request", run_request},
+    {"fragment", run_fragment},
+    {"restart", run_restart},
+    {"compact", run_compact},
+    {"ipc", run_ipc},
+};
+#define NUM_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+/*
+ * run_bench - runs one benchmark in a child process and prints its line.
+ * Returns false if the benchmark failed.
+ */
+static bool run_bench(bench_t *bench, bench_params_t *params) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        void *heap_start = sbrk(0);
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        umalloc_set_free_search(params->search);
+        uinit();
+        long calls = bench->run(params);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (calls < 0) {
+            printf("%-10s failed, umalloc returned NULL\n", bench->name);
+            exit(1);
+        }
+
+        double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        printf("%-10s %12ld %10.4f %14.0f %12ld %12ld\n", bench->name, calls, secs,
+               secs > 0 ? calls / secs : 0.0, usage.ru_maxrss,
+               (long) ((char *) sbrk(0) - (char *) heap_start) / 1024);
+        exit(0);
+    }
+
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+        appl_error("Could not run the benchmark in a child process.");
+    }
+    if (!WIFEXITED(status)) {
+        printf("%-10s crashed\n", bench->name);
+        return false;
+    }
+    return WEXITSTATUS(status) == 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: microbench [-h] [-b bench] [-n ops] [-s size] [-m min] [-M max] [-l live] [-t threads] [-r seed]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-b bench   Run only this benchmark (pingpong, churn, larson, list, longtail, request, fragment, restart, compact, ipc).\n");
+    fprintf(stderr, "\t-n ops     Allocator calls per benchmark (default 1000000).\n");
+    fprintf(stderr, "\t-s size    Request size for pingpong and list (default 64).\n");
+    fprintf(stderr, "\t-m min     Smallest random request size (default 16).\n");
+    fprintf(stderr, "\t-M max     Largest random request size (default 4096, 32768 for longtail).\n");
+    fprintf(stderr, "\t-l live    Live objects for churn, larson, longtail, request, compact and list length (default 1000).\n");
+    fprintf(stderr, "\t-t threads Threads for larson (default 4).\n");
+    fprintf(stderr, "\t-r seed    Random seed (default 1).\n");
+    fprintf(stderr, "\t-S search  Free list search: auto, list, scalar, sse2 or avx2 (default auto).\n");
+}
+
+int main(int argc, char **argv) {
+    bench_params_t params = {
+        .ops = 1000000, .size = 64, .min = 16, .max = 0, .live = 1000, .threads = 4, .seed = 1,
+        .search = FREE_SEARCH_AUTO,
+    };
+    char *only = NULL;
+    char *search = NULL;
+    char c;
+
+    while ((c = getopt(argc, argv, "hb:n:s:m:M:l:t:r:S:")) != EOF) {
+        switch (c) {
+            case 'h':
+                usage();
+                exit(0);
+            case 'b':
+                only = optarg;
+                break;
+            case 'n':
+                params.ops = atol(optarg);
+                break;
+            case 's':
+                params.size = atol(optarg);
+                break;
+            case 'm':
+                params.min = atol(optarg);
+                break;
+            case 'M':
+                params.max = atol(optarg);
+                break;
+            case 'l':
+                params.live = atoi(optarg);
+                break;
+            case 't':
+                params.threads = atoi(optarg);
+                break;
+            case 'r':
+                params.seed = atol(optarg);
+                break;
+            case 'S':
+                search = optarg;
+                break;
+            default:
+                usage();
+                exit(1);
+        }
+    }
+    if (params.ops <= 0 || params.live <= 0 || params.threads <= 0 || params.min == 0 ||
+        (params.max && params.max < params.min)) {
+        usage();
+        appl_error("Invalid benchmark parameters.");
+    }
+    for (free_search_t mode = FREE_SEARCH_AUTO; search && mode <= FREE_SEARCH_AVX2; mode++) {
+        if (!strcmp(search, free_search_name(mode))) {
+            params.search = mode;
+            search = NULL;
+        }
+    }
+    if (search) {
+        usage();
+        appl_error("Unknown free list search.");
+    }
+    if (params.seed == 0) {
+        params.seed = 1; //xorshift never leaves zero
+    }
+
+    printf("%-10s %12s %10s %14s %12s %12s\n", "bench", "calls", "secs", "ops/sec", "peak RSS KB",
+           "heap KB");
+    bool ok = true;
+    bool found = false;
+    for (size_t i = 0; i < NUM_BENCHES; i++) {
+        if (only && strcmp(only, benches[i].name)) {
+            continue;
+        }
+        found = true;
+        bench_params_t run_params = params;
+        if (!run_params.max) {
+            run_params.max = benches[i].run == run_longtail ? 32768 : 4096;
+        }
+        ok &= run_bench(&benches[i], &run_params);
+    }
+    if (!found) {
+        usage();
+        appl_error("Unknown benchmark.");
+    }
+    return ok ? 0 : 1;
+}
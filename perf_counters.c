@@ -0,0 +1,163 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * perf_counters.c - An optional group of hardware performance counters
+ * (perf_event_open) used by the performance harness. Falls back cleanly
+ * when the kernel or container does not expose counters.
+ **************************************************************************/
+
+#include "perf_counters.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define HW_CACHE_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} events[NUM_PERF_EVENTS] = {
+    [PERF_CYCLES]        = {"cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [PERF_INSTRUCTIONS]  = {"instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [PERF_L1D_MISSES]    = {"L1d-misses",    PERF_TYPE_HW_CACHE, HW_CACHE_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    [PERF_LLC_MISSES]    = {"LLC-misses",    PERF_TYPE_HW_CACHE, HW_CACHE_MISS(PERF_COUNT_HW_CACHE_LL)},
+    [PERF_DTLB_MISSES]   = {"dTLB-misses",   PERF_TYPE_HW_CACHE, HW_CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    [PERF_BRANCH_MISSES] = {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+/* Layout of a read() on a counter opened with the read_format below */
+struct read_value {
+    uint64_t value;
+    uint64_t time_enabled;
+    uint64_t time_running;
+};
+
+/*
+ * perf_event_name - returns the display name of a counter.
+ */
+const char *perf_event_name(perf_event_t event) {
+    return events[event].name;
+}
+
+/*
+ * open_event - opens one counter for the calling thread in the given group.
+ * Returns the fd or -1.
+ */
+static int open_event(perf_event_t event, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[event].type;
+    attr.config = events[event].config;
+    attr.disabled = group_fd == -1; //the leader starts the whole group
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+/*
+ * perf_counters_open - opens as many counters as the machine supports in
+ * one group. Returns false, with the reason in pc->error, if not even the
+ * group leader could be opened. Counters missing on this CPU are skipped.
+ */
+bool perf_counters_open(perf_counters_t *pc) {
+    pc->leader = -1;
+    pc->error[0] = '\0';
+    for (int i = 0; i < NUM_PERF_EVENTS; i++) {
+        pc->fds[i] = -1;
+        pc->values[i] = 0;
+        pc->valid[i] = false;
+    }
+
+    for (int i = 0; i < NUM_PERF_EVENTS; i++) {
+        pc->fds[i] = open_event(i, pc->leader);
+        if (pc->fds[i] == -1) {
+            if (pc->leader == -1 && pc->error[0] == '\0') {
+                snprintf(pc->error, sizeof(pc->error), "%s: %s", events[i].name, strerror(errno));
+            }
+            continue;
+        }
+        if (pc->leader == -1) {
+            pc->leader = pc->fds[i];
+        }
+    }
+    return pc->leader != -1;
+}
+
+/*
+ * perf_counters_start - resets and enables the whole group.
+ */
+void perf_counters_start(perf_counters_t *pc) {
+    if (pc->leader == -1) {
+        return;
+    }
+    ioctl(pc->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(pc->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/*
+ * perf_counters_stop - disables the group and reads every counter. Counts
+ * are scaled up if the kernel had to multiplex the group.
+ */
+void perf_counters_stop(perf_counters_t *pc) {
+    if (pc->leader == -1) {
+        return;
+    }
+    ioctl(pc->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    for (int i = 0; i < NUM_PERF_EVENTS; i++) {
+        struct read_value rv;
+        pc->valid[i] = false;
+        if (pc->fds[i] == -1 || read(pc->fds[i], &rv, sizeof(rv)) != sizeof(rv) ||
+            rv.time_running == 0) {
+            continue;
+        }
+        pc->values[i] = rv.value;
+        if (rv.time_running < rv.time_enabled) {
+            pc->values[i] = (uint64_t)((double) rv.value * rv.time_enabled / rv.time_running);
+        }
+        pc->valid[i] = true;
+    }
+}
+
+/*
+ * perf_counters_report - prints each counter's total and its count per op.
+ */
+void perf_counters_report(perf_counters_t *pc, FILE *out, uint64_t num_ops) {
+    if (pc->leader == -1) {
+        fprintf(out, "Counters unavailable (%s)\n", pc->error);
+        return;
+    }
+    fprintf(out, "%-14s %16s %12s\n", "counter", "total", "per op");
+    for (int i = 0; i < NUM_PERF_EVENTS; i++) {
+        if (!pc->valid[i]) {
+            fprintf(out, "%-14s %16s %12s\n", events[i].name, "n/a", "n/a");
+            continue;
+        }
+        fprintf(out, "%-14s %16lu %12.2f\n", events[i].name, pc->values[i],
+                num_ops ? (double) pc->values[i] / num_ops : 0.0);
+    }
+    if (pc->valid[PERF_CYCLES] && pc->valid[PERF_INSTRUCTIONS] && pc->values[PERF_CYCLES]) {
+        fprintf(out, "%-14s %16.2f\n", "IPC",
+                (double) pc->values[PERF_INSTRUCTIONS] / pc->values[PERF_CYCLES]);
+    }
+}
+
+/*
+ * perf_counters_close - closes every counter in the group.
+ */
+void perf_counters_close(perf_counters_t *pc) {
+    for (int i = 0; i < NUM_PERF_EVENTS; i++) {
+        if (pc->fds[i] != -1) {
+            close(pc->fds[i]);
+            pc->fds[i] = -1;
+        }
+    }
+    pc->leader = -1;
+}
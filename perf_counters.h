@@ -0,0 +1,37 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * perf_counters.h - An optional group of hardware performance counters
+ * (perf_event_open) used by the performance harness. Falls back cleanly
+ * when the kernel or container does not expose counters.
+ **************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_BRANCH_MISSES,
+    NUM_PERF_EVENTS
+} perf_event_t;
+
+/* One counter group, the first counter that opens leads the group */
+typedef struct {
+    int fds[NUM_PERF_EVENTS];    /* -1 for counters that could not be opened */
+    int leader;                  /* fd of the group leader, -1 if none opened */
+    uint64_t values[NUM_PERF_EVENTS];
+    bool valid[NUM_PERF_EVENTS]; /* false if the counter never ran */
+    char error[128];             /* why the leader could not be opened */
+} perf_counters_t;
+
+bool perf_counters_open(perf_counters_t *pc);
+void perf_counters_start(perf_counters_t *pc);
+void perf_counters_stop(perf_counters_t *pc);
+void perf_counters_report(perf_counters_t *pc, FILE *out, uint64_t num_ops);
+void perf_counters_close(perf_counters_t *pc);
+const char *perf_event_name(perf_event_t event);
@@ -9,37 +9,437 @@
 
 #include "umalloc.h"
 #include "support.h"
+#include "perf_counters.h"
+#include "allocator.h"
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 
-static void run_trace(trace_t *trace) {
+static bool use_counters = false; // -p, count hardware events around the replay
+static perf_counters_t counters;  // counts from the last replay with -p
+static bool locality = false;     // -L, touch payloads and walk the live blocks
+static long walk_every = 0;       // ops between walks of the live blocks, 0 for none
+static const char *json_path = NULL; // -j, where each replay's JSON record is appended
 
-    struct timespec start, end;
-    clock_gettime(CLOCK_MONOTONIC, &start);
-    uinit();
+#define LINE_SIZE 64
+
+/* Where a replay with -L spent its time */
+typedef struct {
+    uint64_t alloc_ns; /* inside malloc, realloc and free */
+    uint64_t app_ns;   /* writing, reading and walking payloads */
+    long walks;
+    uint64_t sink;     /* everything read, so the reads can't be optimized away */
+} locality_t;
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * read_payload - reads one word from every cache line of a payload.
+ */
+static uint64_t read_payload(void *payload, size_t size) {
+    uint64_t sum = 0;
+    for (size_t off = 0; off + sizeof(uint64_t) <= size; off += LINE_SIZE) {
+        sum += *(volatile uint64_t *) ((char *) payload + off);
+    }
+    return sum;
+}
+
+/*
+ * walk_live - visits the live blocks in the order they were first allocated
+ * and reads each one, like a program traversing a linked structure. Ids that
+ * have been freed are dropped from order on the way.
+ */
+static uint64_t walk_live(trace_t *trace, int *order, int *num_order) {
+    uint64_t sum = 0;
+    int kept = 0;
+    for (int i = 0; i < *num_order; i++) {
+        allocated_block_t *block = &trace->blocks[order[i]];
+        if (!block->payload) {
+            block->is_allocated = false;
+            continue;
+        }
+        sum += read_payload(block->payload, block->block_size);
+        order[kept++] = order[i];
+    }
+    *num_order = kept;
+    return sum;
+}
+
+/*
+ * replay - runs the trace's ops against the backend and nothing else. If
+ * latency_ns is not NULL, how long each op took is stored in it.
+ */
+static void replay(trace_t *trace, allocator_t *alloc, uint64_t *latency_ns) {
     for(size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
         if (curr_op % 5 == 0) {
             sbrk(4096);
         }
+        uint64_t start = latency_ns ? now_ns() : 0;
         traceop_t op = trace->ops[curr_op];
         if (op.type == ALLOC) {
-            trace->blocks[op.index].payload = umalloc(op.size);
+            trace->blocks[op.index].payload = alloc->malloc(op.size);
+            trace->blocks[op.index].block_size = op.size;
+        } else if (op.type == REALLOC) {
+            allocated_block_t *block = &trace->blocks[op.index];
+            block->payload = allocator_realloc(alloc, block->payload, block->block_size, op.size);
+            block->block_size = op.size;
+        } else {
+            alloc->free(trace->blocks[op.index].payload);
+            trace->blocks[op.index].payload = NULL; //a later realloc of the id allocates
+        }
+        if (latency_ns) {
+            latency_ns[curr_op] = now_ns() - start;
+        }
+    }
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * percentile - the q-th quantile of n sorted values.
+ */
+static uint64_t percentile(uint64_t *sorted, size_t n, double q) {
+    size_t i = q * n;
+    return sorted[i < n ? i : n - 1];
+}
+
+/*
+ * write_json_result - replays the trace once more on a fresh heap, timing
+ * every op, and appends the run's throughput and latency percentiles to the
+ * -j file. The latencies include the cost of reading the clock.
+ */
+static void write_json_result(const char *path, trace_t *trace, allocator_t *alloc, uint64_t delta_us) {
+    uint64_t *latency_ns = malloc(trace->num_ops * sizeof(uint64_t));
+    if (latency_ns == NULL) {
+        appl_error("Failed to allocate the op latencies");
+    }
+    for (int id = 0; id < trace->num_ids; id++) {
+        trace->blocks[id].payload = NULL;
+        trace->blocks[id].block_size = 0;
+    }
+    allocator_init(alloc);
+    replay(trace, alloc, latency_ns);
+    qsort(latency_ns, trace->num_ops, sizeof(uint64_t), compare_u64);
+
+    FILE *out = open_json(json_path);
+    fprintf(out, "{\"tool\": \"performance\", \"trace\": ");
+    write_json_string(out, path);
+    fprintf(out, ", \"backend\": ");
+    write_json_string(out, alloc->name);
+    fprintf(out, ", \"ops\": %d, \"us\": %lu, \"ops_per_ms\": %.2f", trace->num_ops, delta_us,
+            delta_us ? 1000.0 * trace->num_ops / delta_us : 0.0);
+    size_t n = trace->num_ops;
+    fprintf(out, ", \"latency_ns\": {\"p50\": %lu, \"p90\": %lu, \"p99\": %lu", percentile(latency_ns, n, 0.5),
+            percentile(latency_ns, n, 0.9), percentile(latency_ns, n, 0.99));
+    fprintf(out, ", \"p999\": %lu, \"max\": %lu}}\n", percentile(latency_ns, n, 0.999), latency_ns[n - 1]);
+    fclose(out);
+    free(latency_ns);
+}
+
+/*
+ * replay_touching - runs the trace the way a program would use the memory.
+ * Every payload is written when it is allocated or grown and read before it
+ * is freed, and every walk_every ops the live blocks are walked. Time in the
+ * allocator and time touching memory are kept apart in split.
+ */
+static void replay_touching(trace_t *trace, allocator_t *alloc, int *order, locality_t *split) {
+    int num_order = 0;
+    for (int id = 0; id < trace->num_ids; id++) {
+        trace->blocks[id].is_allocated = false; //true while the id is in order
+    }
+
+    for(size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
+        if (curr_op % 5 == 0) {
+            sbrk(4096);
+        }
+        traceop_t op = trace->ops[curr_op];
+        allocated_block_t *block = &trace->blocks[op.index];
+        uint64_t start = now_ns();
+        if (op.type == FREE) {
+            split->sink += read_payload(block->payload, block->block_size);
+            uint64_t freeing = now_ns();
+            alloc->free(block->payload);
+            block->payload = NULL;
+            split->app_ns += freeing - start;
+            split->alloc_ns += now_ns() - freeing;
         } else {
-            ufree(trace->blocks[op.index].payload);
+            size_t old_size = block->payload ? block->block_size : 0;
+            if (op.type == ALLOC) {
+                block->payload = alloc->malloc(op.size);
+            } else {
+                block->payload = allocator_realloc(alloc, block->payload, old_size, op.size);
+            }
+            block->block_size = op.size;
+            uint64_t touching = now_ns();
+            //a realloc keeps its contents, only the new tail is written
+            if (block->payload && (size_t) op.size > old_size) {
+                memset((char *) block->payload + old_size, curr_op, op.size - old_size);
+            }
+            if (block->payload && !block->is_allocated) {
+                block->is_allocated = true;
+                order[num_order++] = op.index;
+            }
+            split->alloc_ns += touching - start;
+            split->app_ns += now_ns() - touching;
+        }
+
+        if (walk_every && (curr_op + 1) % walk_every == 0) {
+            start = now_ns();
+            split->sink += walk_live(trace, order, &num_order);
+            split->app_ns += now_ns() - start;
+            split->walks++;
         }
     }
+}
+
+/*
+ * run_trace - replays the trace at path against one backend, prints and
+ * returns the elapsed microseconds.
+ */
+static uint64_t run_trace(const char *path, trace_t *trace, allocator_t *alloc) {
+    perf_counters_t *pc = &counters;
+    if (use_counters) {
+        perf_counters_open(pc);
+    }
+    locality_t split = {0};
+    int *order = NULL;
+    if (locality && (order = malloc(trace->num_ids * sizeof(int))) == NULL) {
+        appl_error("Failed to allocate the allocation order");
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (use_counters) {
+        perf_counters_start(pc);
+    }
+    allocator_init(alloc);
+    if (locality) {
+        replay_touching(trace, alloc, order, &split);
+    } else {
+        replay(trace, alloc, NULL);
+    }
+    if (use_counters) {
+        perf_counters_stop(pc);
+    }
     clock_gettime(CLOCK_MONOTONIC, &end);
     uint64_t delta_us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
     printf("Success: %ld", delta_us);
+
+    if (locality) {
+        uint64_t timed = split.alloc_ns + split.app_ns;
+        printf("\nallocator %lu us, memory access %lu us (%.1f%% in the allocator), %ld walks",
+               split.alloc_ns / 1000, split.app_ns / 1000, timed ? 100.0 * split.alloc_ns / timed : 0.0,
+               split.walks);
+        free(order);
+    }
+
+    if (use_counters) {
+        printf("\n");
+        perf_counters_report(pc, stdout, trace->num_ops);
+        perf_counters_close(pc);
+    }
+    if (json_path) {
+        write_json_result(path, trace, alloc, delta_us);
+    }
+    return delta_us;
+}
+
+/*
+ * run_forked - replays the trace in a child process so every backend starts
+ * from a clean process. Returns the elapsed microseconds, 0 if the child died.
+ */
+static uint64_t run_forked(const char *path, trace_t *trace, allocator_t *alloc, uint64_t *result) {
+    fflush(stdout);
+    *result = 0;
+    pid_t pid = fork();
+    if (pid == 0) {
+        printf("%-12s ", alloc->name);
+        *result = run_trace(path, trace, alloc);
+        printf("\n");
+        exit(0);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+        appl_error("Could not run the trace in a child process.");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("%-12s failed\n", alloc->name);
+    }
+    return *result;
+}
+
+/*
+ * compare_hugepages - replays the trace on a base page heap and then on a
+ * huge page heap and reports how the dTLB misses changed.
+ */
+static void compare_hugepages(const char *path, trace_t *trace, allocator_t *alloc) {
+    uint64_t misses[2] = {0, 0};
+    bool valid = true;
+    for (int huge = 0; huge < 2; huge++) {
+        umalloc_use_hugepages(huge);
+        printf("%s pages\n", huge ? "Huge" : "Base");
+        run_trace(path, trace, alloc);
+        valid &= counters.valid[PERF_DTLB_MISSES];
+        misses[huge] = counters.values[PERF_DTLB_MISSES];
+    }
+    umalloc_use_hugepages(false);
+
+    if (!valid) {
+        printf("dTLB misses unavailable, no difference to report\n");
+        return;
+    }
+    printf("dTLB-misses    base %lu, huge %lu (%+.1f%%)\n", misses[0], misses[1],
+           misses[0] ? 100.0 * ((double) misses[1] - misses[0]) / misses[0] : 0.0);
+}
+
+/*
+ * print_thp_mode - shows the kernel's transparent huge page setting, huge
+ * page mode needs it to be [always] or [madvise].
+ */
+static void print_thp_mode(void) {
+    char mode[128] = "unknown\n";
+    FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    if (f) {
+        if (!fgets(mode, sizeof(mode), f)) {
+            strcpy(mode, "unknown\n");
+        }
+        fclose(f);
+    }
+    printf("Transparent huge pages: %s", mode);
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: performance [-pH] [-L n] [-j file] [-a backend]... file...\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-p         Report hardware performance counters per trace and per op.\n");
+    fprintf(stderr, "\t-a backend Replay against umalloc (default), glibc or a .so exporting uinit,\n");
+    fprintf(stderr, "\t           umalloc and ufree. Repeat to compare backends side by side.\n");
+    fprintf(stderr, "\t-H         Replay on base pages then on huge pages and report the dTLB misses.\n");
+    fprintf(stderr, "\t-L n       Write payloads on allocation, read them before freeing and walk the\n");
+    fprintf(stderr, "\t           live blocks in allocation order every n ops (0 for no walks).\n");
+    fprintf(stderr, "\t           Reports allocator time apart from memory access time.\n");
+    fprintf(stderr, "\t-j file    Append each replay's throughput and op latency percentiles to\n");
+    fprintf(stderr, "\t           file as a JSON line. Costs a second, timed replay.\n");
 }
 
 
 
 int main(int argc, char **argv) { 
-    if (argc < 2) {
-        fprintf(stderr, "Usage: performance file\n");
+    allocator_t *backends[MAX_ALLOCATORS];
+    int num_backends = 0;
+    bool hugepages = false;
+    char c;
+    while ((c = getopt(argc, argv, "phHL:j:a:")) != EOF) {
+        switch (c) {
+            case 'p':
+                use_counters = true;
+                break;
+            case 'H':
+                hugepages = true;
+                break;
+            case 'L':
+                locality = true;
+                walk_every = atol(optarg);
+                break;
+            case 'j':
+                json_path = optarg;
+                break;
+            case 'a':
+                if (num_backends == MAX_ALLOCATORS) {
+                    appl_error("Too many backends.");
+                }
+                backends[num_backends++] = allocator_load(optarg);
+                break;
+            case 'h':
+                usage();
+                exit(0);
+            default:
+                usage();
+                exit(1);
+        }
+    }
+    if (optind >= argc) {
+        usage();
         appl_error("No File parameter provided.");
     }
-    trace_t *trace = read_trace(argv[1], 0);
-    run_trace(trace);
-    free_trace(trace);
+    if (num_backends == 0) {
+        backends[num_backends++] = allocator_load("umalloc");
+    }
+
+    int num_traces = argc - optind;
+    if (json_path && (hugepages || locality)) {
+        appl_error("JSON results only cover plain replays, not -H or -L.");
+    }
+    if (hugepages) {
+        if (num_backends > 1 || !backends[0]->native) {
+            appl_error("Huge page mode only applies to the linked umalloc.");
+        }
+        use_counters = true;
+        print_thp_mode();
+        for (int i = optind; i < argc; i++) {
+            printf("\n%s\n", argv[i]);
+            trace_t *trace = read_trace(argv[i], 0);
+            compare_hugepages(argv[i], trace, backends[0]);
+            free_trace(trace);
+        }
+        allocator_unload(backends[0]);
+        return 0;
+    }
+    if (num_backends == 1) {
+        for (int i = optind; i < argc; i++) {
+            if (num_traces > 1) {
+                printf("%s%s\n", i > optind ? "\n" : "", argv[i]);
+            }
+            trace_t *trace = read_trace(argv[i], 0);
+            run_trace(argv[i], trace, backends[0]);
+            free_trace(trace);
+        }
+        allocator_unload(backends[0]);
+        return 0;
+    }
+
+    //children report their time through memory shared with the parent
+    uint64_t *results = mmap(NULL, num_traces * num_backends * sizeof(uint64_t),
+                             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) {
+        appl_error("Could not map the result table.");
+    }
+    int *num_ops = malloc(num_traces * sizeof(int));
+    for (int i = 0; i < num_traces; i++) {
+        printf("%s%s\n", i > 0 ? "\n" : "", argv[optind + i]);
+        trace_t *trace = read_trace(argv[optind + i], 0);
+        num_ops[i] = trace->num_ops;
+        for (int b = 0; b < num_backends; b++) {
+            run_forked(argv[optind + i], trace, backends[b], &results[i * num_backends + b]);
+        }
+        free_trace(trace);
+    }
+
+    printf("\nOperations per millisecond\n%-30s", "trace");
+    for (int b = 0; b < num_backends; b++) {
+        printf(" %12s", backends[b]->name);
+    }
+    printf("\n");
+    for (int i = 0; i < num_traces; i++) {
+        printf("%-30s", argv[optind + i]);
+        for (int b = 0; b < num_backends; b++) {
+            uint64_t us = results[i * num_backends + b];
+            printf(" %12.2f", us ? 1000.0 * num_ops[i] / us : 0.0);
+        }
+        printf("\n");
+    }
+
+    free(num_ops);
+    munmap(results, num_traces * num_backends * sizeof(uint64_t));
+    for (int b = 0; b < num_backends; b++) {
+        allocator_unload(backends[b]);
+    }
     return 0;
 }
\ No newline at end of file
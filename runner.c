@@ -11,11 +11,30 @@
 #include "csbrk.h"
 #include "support.h"
 #include "check_heap.h"
+#include "heapmap.h"
+#include "allocator.h"
 #include <sys/mman.h>
+#include <sys/wait.h>
 
 int verbose = 0;
-char msg[MAXLINE];      /* for whenever we need to compose an error message */
-extern size_t sbrk_bytes;
+int phase_report = 0;   /* print umalloc's phase breakdown after the trace */
+FILE *map_file = NULL;  /* where heap map snapshots are written */
+size_t map_every = 0;   /* write a heap map snapshot every map_every ops */
+allocator_t *alloc;     /* the backend the trace runs against */
+lifetime_t *hints = NULL; /* lifetime each alloc op is hinted with, NULL for none */
+char *json_path = NULL; /* where -j appends one JSON record per run, NULL for none */
+char *trace_path;       /* the trace being run, for the JSON records */
+int placement_report = 0; /* report the placement policy over each stretch of the trace */
+
+/* A stretch of the trace that ran under one placement policy */
+typedef struct {
+    size_t from; /* first op of the stretch */
+    placement_t policy;
+} placement_span_t;
+
+placement_span_t *spans = NULL;
+size_t num_spans = 0;
+size_t span_capacity = 0;
 extern const char author[];
 
 /* 
@@ -23,13 +42,93 @@ extern const char author[];
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-rhvuc] file\n");
+    fprintf(stderr, "Usage: mdriver [-rhvucPl] [-F policy] [-m n] [-M mapfile] [-j file] [-a backend]... file\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-r         Run the trace to completion (bypass interface).\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-v         Print additional debug info.\n");
     fprintf(stderr, "\t-u         Display heap utilization.\n");
     fprintf(stderr, "\t-c         Runs the user provided heap check after every op.\n");
+    fprintf(stderr, "\t-P         Print umalloc's phase timers after the trace (make PHASES=1).\n");
+    fprintf(stderr, "\t-l         Hint every alloc with its true lifetime through umalloc_hint.\n");
+    fprintf(stderr, "\t-F policy  Place blocks by best, good, first, next or adaptive fit and report\n");
+    fprintf(stderr, "\t           the policy each stretch of the trace ran under.\n");
+    fprintf(stderr, "\t-m n       Write a heap map snapshot every n ops.\n");
+    fprintf(stderr, "\t-M file    File heap map snapshots go to (default heapmap.csv).\n");
+    fprintf(stderr, "\t-j file    Append each backend's result to file as a JSON line (needs -r).\n");
+    fprintf(stderr, "\t-a backend Run against umalloc (default), glibc or a .so exporting uinit,\n");
+    fprintf(stderr, "\t           umalloc and ufree. Repeat with -r to compare backends.\n");
+}
+
+/*
+ * lifetime_oracle - Looks ahead in the trace to hint each alloc with the
+ * lifetime it will actually have: short if its id is freed within
+ * LIFETIME_SHORT_ALLOCS allocations, long otherwise. Ids that are
+ * reallocated are left to the allocator.
+ */
+static lifetime_t *lifetime_oracle(trace_t *trace) {
+    lifetime_t *oracle = calloc(trace->num_ops, sizeof(lifetime_t));
+    int *born_op = malloc(trace->num_ids * sizeof(int));
+    size_t *born_at = malloc(trace->num_ids * sizeof(size_t));
+    if (!oracle || !born_op || !born_at) {
+        appl_error("Could not allocate the lifetime hints.");
+    }
+    for (int id = 0; id < trace->num_ids; id++) {
+        born_op[id] = -1;
+    }
+
+    size_t allocs = 0;
+    for (int i = 0; i < trace->num_ops; i++) {
+        traceop_t op = trace->ops[i];
+        if (op.type == ALLOC) {
+            oracle[i] = LIFETIME_LONG;
+            born_op[op.index] = i;
+            born_at[op.index] = allocs++;
+        } else if (op.type == FREE && born_op[op.index] >= 0) {
+            if (allocs - born_at[op.index] <= LIFETIME_SHORT_ALLOCS) {
+                oracle[born_op[op.index]] = LIFETIME_SHORT;
+            }
+            born_op[op.index] = -1;
+        } else if (op.type == REALLOC && born_op[op.index] >= 0) {
+            oracle[born_op[op.index]] = LIFETIME_UNKNOWN;
+            born_op[op.index] = -1;
+        }
+    }
+    free(born_op);
+    free(born_at);
+    return oracle;
+}
+
+/*
+ * note_placement - Starts a new stretch at op when umalloc's placement
+ * policy is not the one the current stretch ran under.
+ */
+static void note_placement(size_t op) {
+    placement_t policy = umalloc_placement();
+    if (num_spans && spans[num_spans - 1].policy == policy) {
+        return;
+    }
+    if (num_spans == span_capacity) {
+        span_capacity = span_capacity ? 2 * span_capacity : 16;
+        if ((spans = realloc(spans, span_capacity * sizeof(placement_span_t))) == NULL) {
+            appl_error("Could not allocate the placement report.");
+        }
+    }
+    spans[num_spans].from = op;
+    spans[num_spans].policy = policy;
+    num_spans++;
+}
+
+/*
+ * print_placement - Prints the placement policy of every stretch of the
+ * first num_ops ops.
+ */
+static void print_placement(size_t num_ops) {
+    printf("Placement by trace phase:\n");
+    for (size_t i = 0; i < num_spans; i++) {
+        size_t to = i + 1 < num_spans ? spans[i + 1].from : num_ops;
+        printf("  ops %7zu - %7zu  %s\n", spans[i].from, to - 1, placement_name(spans[i].policy));
+    }
 }
 
 /* 
@@ -84,14 +183,16 @@ static int check_correctness(trace_t *trace, size_t curr_op) {
 
 size_t curr_bytes_in_use;
 size_t max_bytes_in_use;
+size_t max_heap_bytes;
 
 /* 
  * UTILIZATION_SCORE - the utilization score represents how well the umalloc
  * package uses the bytes requested from sbrk. For example, if 100 bytes are
  * requested from sbrk, and the user requested 80 bytes, there will be a 
- * utilization score of 80%.
+ * utilization score of 80%. Backends that give memory back are scored
+ * against the most they ever held.
  */
-#define UTILIZATION_SCORE 100.0 * max_bytes_in_use / sbrk_bytes
+#define UTILIZATION_SCORE (max_heap_bytes ? 100.0 * max_bytes_in_use / max_heap_bytes : 0.0)
 
 /* 
  * run_trace_line - Runs a single line in the trace. Checking if all the 
@@ -116,7 +217,8 @@ static int run_trace_line(trace_t *trace, size_t curr_op, int utilization, int r
             printf("line %ld: umalloc: id %d, Allocating %d bytes\n", LINENUM(curr_op), op.index, op.size);
         }
 
-        trace->blocks[op.index].payload = umalloc(op.size);
+        trace->blocks[op.index].payload =
+            hints ? umalloc_hint(op.size, hints[curr_op]) : alloc->malloc(op.size);
         curr_bytes_in_use += op.size;
         if ( trace->blocks[op.index].payload == NULL) {
             malloc_error(curr_op, "umalloc failed.");
@@ -128,12 +230,54 @@ static int run_trace_line(trace_t *trace, size_t curr_op, int utilization, int r
             return -1;
         }
 
-        if(check_malloc_output(trace->blocks[op.index].payload, trace->blocks[op.index].block_size) == -1) {
+        if(alloc->check_output &&
+           alloc->check_output(trace->blocks[op.index].payload, trace->blocks[op.index].block_size) == -1) {
             printf("line %ld: umalloc allocated a block out of bounds.\n", LINENUM(curr_op));
             return -1;
         }
 
         copy_id((size_t*) trace->blocks[op.index].payload, trace->blocks[op.index].block_size, curr_op);
+    } else if (op.type == REALLOC) {
+        allocated_block_t *block = &trace->blocks[op.index];
+        //realloc of an id that isn't live behaves like an alloc
+        void *old_payload = block->is_allocated ? block->payload : NULL;
+        size_t old_size = block->is_allocated ? block->block_size : 0;
+
+        if (verbose) {
+            printf("line %ld: urealloc: id %d, Resizing %lu to %d bytes\n", LINENUM(curr_op), op.index,
+                   old_size, op.size);
+        }
+
+        void *payload = allocator_realloc(alloc, old_payload, old_size, op.size);
+        if (payload == NULL) {
+            malloc_error(curr_op, "urealloc failed.");
+            return -1;
+        }
+        block->payload = payload;
+        block->is_allocated = true;
+        curr_bytes_in_use += op.size - old_size;
+
+        if (((size_t)payload) % ALIGNMENT != 0) {
+            malloc_error(curr_op, "urealloc returned an unaligned payload.");
+            return -1;
+        }
+
+        if(alloc->check_output && alloc->check_output(payload, op.size) == -1) {
+            printf("line %ld: urealloc moved a block out of bounds.\n", LINENUM(curr_op));
+            return -1;
+        }
+
+        //the contents up to the smaller size must have come along
+        size_t kept = old_size < (size_t) op.size ? old_size : op.size;
+        if (check_id(payload, kept, block->content_val) == -1) {
+            sprintf(msg, "urealloc lost the contents of block id %d.", op.index);
+            malloc_error(curr_op, msg);
+            return -1;
+        }
+
+        block->content_val = curr_op;
+        block->block_size = op.size;
+        copy_id((size_t*) payload, op.size, curr_op);
     } else {
         trace->blocks[op.index].is_allocated = false;
 
@@ -141,13 +285,17 @@ static int run_trace_line(trace_t *trace, size_t curr_op, int utilization, int r
             printf("line %ld: ufree: id %d\n", LINENUM(curr_op), op.index);
         }
 
-        ufree(trace->blocks[op.index].payload);
+        alloc->free(trace->blocks[op.index].payload);
         curr_bytes_in_use -= trace->blocks[op.index].block_size;
     }
 
     if (curr_bytes_in_use > max_bytes_in_use) {
         max_bytes_in_use = curr_bytes_in_use;
     }
+    size_t heap_bytes = allocator_heap_bytes(alloc);
+    if (heap_bytes > max_heap_bytes) {
+        max_heap_bytes = heap_bytes;
+    }
 
     if (run_check_heap) {
         if (check_heap() != 0) {
@@ -163,13 +311,42 @@ static int run_trace_line(trace_t *trace, size_t curr_op, int utilization, int r
         return -1;
     }
 
+    if (placement_report) {
+        note_placement(curr_op + 1);
+    }
+
     if (verbose && utilization) {
         printf("Current Utilization percentage: %.2f\n", UTILIZATION_SCORE);
     }
 
+    if (map_every && (curr_op + 1) % map_every == 0) {
+        if (write_heap_map(map_file, curr_op + 1) == -1) {
+            malloc_error(curr_op, "heap map walk found a broken region.");
+            return -1;
+        }
+    }
+
   return 0;
 }
 
+/*
+ * write_json_result - Appends the current backend's result on the trace to
+ * the -j file: whether it passed and, if it did, its utilization.
+ */
+static void write_json_result(bool passed) {
+    if (!json_path) {
+        return;
+    }
+    FILE *out = open_json(json_path);
+    fprintf(out, "{\"tool\": \"runner\", \"trace\": ");
+    write_json_string(out, trace_path);
+    fprintf(out, ", \"backend\": ");
+    write_json_string(out, alloc->name);
+    fprintf(out, ", \"passed\": %s, \"utilization\": %.2f}\n", passed ? "true" : "false",
+            passed ? UTILIZATION_SCORE : 0.0);
+    fclose(out);
+}
+
 /* 
  * auto_run_trace - Starting from curr_op, runs the trace to completetion. 
  * Printing the utlilization and running check_heap if requested. 
@@ -184,15 +361,23 @@ static int auto_run_trace(trace_t *trace, int utilization, int run_check_heap, s
     for(;curr_op < trace->num_ops; curr_op++) {
         if (run_trace_line(trace, curr_op, utilization, run_check_heap) == -1) {
             printf("umalloc package failed.\n");
+            write_json_result(false);
             exit(1);
         }
     }
 
     printf("umalloc package passed correctness check.\n");
+    write_json_result(true);
 
     if (utilization) {
         printf("Final Utilization percentage: %.2f\n", UTILIZATION_SCORE);
     }
+    if (phase_report && alloc->native) {
+        umalloc_phase_report(stdout);
+    }
+    if (placement_report) {
+        print_placement(trace->num_ops);
+    }
     return curr_op;
 }
 
@@ -205,6 +390,8 @@ void help() {
     printf("run n            -  execute trace for n ops\n");
     printf("check            -  run the heap_check                \n");
     printf("util             -  display current heap utilization   \n");
+    printf("map file         -  write a heap map snapshot to file   \n");
+    printf("phases           -  display umalloc's phase timers       \n");
     printf("help             -  display this help menu            \n");
     printf("quit             -  exit the program                  \n\n");
 }
@@ -215,6 +402,7 @@ void help() {
  */
 void interactive_run_trace(trace_t *trace, int utilization, int run_check_heap) {                         
   char buffer[20];
+  char path[MAXLINE];
   int ops_to_run;
   int ret;
   size_t curr_op = 0;
@@ -236,6 +424,10 @@ void interactive_run_trace(trace_t *trace, int utilization, int run_check_heap)
     
     case 'C':
     case 'c':
+        if (!alloc->native) {
+            printf("check_heap only understands the linked umalloc.\n");
+            break;
+        }
         printf("Running check_heap.\n");
         ret = check_heap();
         if (ret != 0)
@@ -257,6 +449,36 @@ void interactive_run_trace(trace_t *trace, int utilization, int run_check_heap)
         printf("Current Utilization percentage: %.2f\n", UTILIZATION_SCORE);
         break;
 
+    case 'M':
+    case 'm':
+        size = scanf("%1023s", path);
+        if (size != 1) {
+            break;
+        }
+        if (!alloc->native) {
+            printf("Heap maps only understand the linked umalloc.\n");
+            break;
+        }
+        FILE *snapshot = fopen(path, "w");
+        if (snapshot == NULL) {
+            printf("Could not open %s.\n", path);
+            break;
+        }
+        write_heap_map_header(snapshot);
+        ret = write_heap_map(snapshot, curr_op);
+        fclose(snapshot);
+        printf("Wrote %d heap map rows to %s.\n", ret, path);
+        break;
+
+    case 'P':
+    case 'p':
+        if (!alloc->native) {
+            printf("Phase timers only exist in the linked umalloc.\n");
+            break;
+        }
+        umalloc_phase_report(stdout);
+        break;
+
     case 'R':
     case 'r':
         size = scanf("%d", &ops_to_run);
@@ -295,6 +517,69 @@ void interactive_run_trace(trace_t *trace, int utilization, int run_check_heap)
 }
 
 
+/* Outcome of one backend's run when several are compared */
+typedef struct {
+    bool passed;
+    double utilization;
+} backend_result_t;
+
+/* 
+ * start_backend - Starts the current backend on a fresh heap and resets the
+ * utilization counters.
+ */
+static void start_backend(void) {
+    if (allocator_init(alloc) == -1) {
+        malloc_error(-3, "uinit failed.");
+        exit(1);
+    }
+    curr_bytes_in_use = 0;
+    max_bytes_in_use = 0;
+    max_heap_bytes = allocator_heap_bytes(alloc);
+    num_spans = 0;
+    if (placement_report) {
+        note_placement(0);
+    }
+}
+
+/* 
+ * compare_backends - Runs the trace to completion against each backend in its
+ * own child process, then prints the results side by side.
+ */
+static void compare_backends(trace_t *trace, allocator_t **backends, int num_backends,
+                             int run_check_heap) {
+    backend_result_t *results = mmap(NULL, num_backends * sizeof(backend_result_t),
+                                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) {
+        appl_error("Could not map the result table.");
+    }
+
+    for (int b = 0; b < num_backends; b++) {
+        printf("\nBackend: %s\n", backends[b]->name);
+        fflush(stdout);
+        results[b].passed = false;
+        pid_t pid = fork();
+        if (pid == 0) {
+            alloc = backends[b];
+            start_backend();
+            auto_run_trace(trace, 1, run_check_heap, 0);
+            results[b].passed = true;
+            results[b].utilization = UTILIZATION_SCORE;
+            exit(0);
+        }
+        int status;
+        if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+            appl_error("Could not run the trace in a child process.");
+        }
+    }
+
+    printf("\n%-20s %8s %12s\n", "Backend", "Passed", "Utilization");
+    for (int b = 0; b < num_backends; b++) {
+        printf("%-20s %8s %12.2f\n", backends[b]->name, results[b].passed ? "Yes" : "No",
+               results[b].utilization);
+    }
+    munmap(results, num_backends * sizeof(backend_result_t));
+}
+
 int main(int argc, char **argv)
 {
 
@@ -304,7 +589,12 @@ int main(int argc, char **argv)
   /* 
     * Read and interpret the command line arguments 
     */
-  while ((c = getopt(argc, argv, "rvhcu")) != EOF) {
+  char *map_path = "heapmap.csv";
+  allocator_t *backends[MAX_ALLOCATORS];
+  int num_backends = 0;
+
+  int lifetime_hints = 0;
+  while ((c = getopt(argc, argv, "rvhcuPlF:m:M:j:a:")) != EOF) {
     switch (c) {
     case 'r': /* Generate summary info for the autograder */
         autorun = 1;
@@ -321,6 +611,39 @@ int main(int argc, char **argv)
     case 'u':
         display_utilization = 1;
         break;
+    case 'P':
+        phase_report = 1;
+        break;
+    case 'l':
+        lifetime_hints = 1;
+        break;
+    case 'F':
+        for (placement_t mode = 0; mode <= NUM_PLACEMENTS; mode++) {
+            if (mode == NUM_PLACEMENTS) {
+                appl_error("Unknown placement policy.");
+            }
+            if (!strcmp(optarg, placement_name(mode))) {
+                umalloc_set_placement(mode);
+                break;
+            }
+        }
+        placement_report = 1;
+        break;
+    case 'm':
+        map_every = strtoul(optarg, NULL, 10);
+        break;
+    case 'M':
+        map_path = optarg;
+        break;
+    case 'j':
+        json_path = optarg;
+        break;
+    case 'a':
+        if (num_backends == MAX_ALLOCATORS) {
+            appl_error("Too many backends.");
+        }
+        backends[num_backends++] = allocator_load(optarg);
+        break;
     default:
         usage();
         exit(1);
@@ -334,6 +657,28 @@ int main(int argc, char **argv)
         appl_error("Missing file parameters.");
     }
 
+    if (num_backends == 0) {
+        backends[num_backends++] = allocator_load("umalloc");
+    }
+    for (int b = 0; b < num_backends; b++) {
+        if ((run_check_heap || map_every) && !backends[b]->native) {
+            appl_error("check_heap and heap maps only understand the linked umalloc.");
+        }
+        if (lifetime_hints && !backends[b]->native) {
+            appl_error("Lifetime hints need the linked umalloc.");
+        }
+        if (placement_report && !backends[b]->native) {
+            appl_error("Placement policies need the linked umalloc.");
+        }
+    }
+    if (num_backends > 1 && (!autorun || map_every)) {
+        appl_error("Comparing backends needs -r and no heap maps.");
+    }
+    if (json_path && !autorun) {
+        appl_error("JSON results need -r.");
+    }
+    trace_path = file;
+
     if (verbose) {
         if (autorun) {
             printf("Auto Run Enabled.\n");
@@ -352,16 +697,32 @@ int main(int argc, char **argv)
     printf("Author: %s\n", author);
 
     trace_t *trace = read_trace(file, verbose);
-    if (uinit() == -1) {
-        malloc_error(-3, "uinit failed.");
-        exit(1);
+    if (lifetime_hints) {
+        hints = lifetime_oracle(trace);
+    }
+    if (num_backends > 1) {
+        compare_backends(trace, backends, num_backends, run_check_heap);
+        free_trace(trace);
+        exit(0);
+    }
+    alloc = backends[0];
+    start_backend();
+    if (map_every) {
+        if ((map_file = fopen(map_path, "w")) == NULL) {
+            sprintf(msg, "Could not open %s for the heap map", map_path);
+            appl_error(msg);
+        }
+        write_heap_map_header(map_file);
     }
-    curr_bytes_in_use = 0;
-    max_bytes_in_use = 0;
     if (autorun) {
         auto_run_trace(trace, display_utilization, run_check_heap, 0);
     } else {
         interactive_run_trace(trace, display_utilization, run_check_heap);
     }
     free_trace(trace);
+    free(hints);
+    free(spans);
+    if (map_file) {
+        fclose(map_file);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,75 @@
+/* Generated by gen_size_classes from:
+ *   traces/amptjp-bal.rep
+ *   traces/binary-bal.rep
+ *   traces/binary2-bal.rep
+ *   traces/cccp-bal.rep
+ *   traces/coalescing-bal.rep
+ *   traces/cp-decl-bal.rep
+ *   traces/expr-bal.rep
+ *   traces/random-bal.rep
+ *   traces/random2-bal.rep
+ *   traces/short1-bal.rep
+ *   traces/short2-bal.rep
+ * Do not edit by hand, run `make classes` instead.
+ */
+
+#ifndef SIZE_CLASSES_H
+#define SIZE_CLASSES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NUM_SIZE_CLASSES 16
+#define SIZE_CLASS_LOOKUP_MAX 1024
+
+/* Largest payload held by each class, the last class is unbounded */
+static const size_t size_class_bounds[NUM_SIZE_CLASSES] = {
+    16,
+    32,
+    48,
+    64,
+    80,
+    112,
+    128,
+    144,
+    160,
+    176,
+    192,
+    448,
+    464,
+    512,
+    1024,
+    SIZE_MAX,
+};
+
+/* Bytes to request from csbrk when a class has no fit, 0 means exact */
+static const size_t size_class_slab_sizes[NUM_SIZE_CLASSES] = {
+    4096,
+    4096,
+    4096,
+    4096,
+    4096,
+    8192,
+    8192,
+    8192,
+    8192,
+    8192,
+    8192,
+    16384,
+    16384,
+    20480,
+    36864,
+    0,
+};
+
+/* Size class of every aligned size up to SIZE_CLASS_LOOKUP_MAX, indexed by
+ * size / ALIGNMENT. Larger sizes clamp to the last entry. */
+static const uint8_t size_class_lookup[SIZE_CLASS_LOOKUP_MAX / 16 + 2] = {
+    0, 0, 1, 2, 3, 4, 5, 5, 6, 7, 8, 9, 10, 11, 11, 11,
+    11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 12, 13, 13,
+    13, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+    14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+    14, 15,
+};
+
+#endif /* SIZE_CLASSES_H */
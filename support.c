@@ -102,6 +102,16 @@ trace_t *read_trace(char *filename, int verbose)
             trace->ops[op_index].type = FREE;
             trace->ops[op_index].index = index;
         break;
+        case 'r':
+            err = fscanf(tracefile, "%u %u", &index, &size);
+            if (err == EOF) {
+                appl_error("fscanf failed to find index and size.");
+            }
+            trace->ops[op_index].type = REALLOC;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].size = size;
+            max_index = (index > max_index) ? index : max_index;
+            break;
         default:
             sprintf(msg, "Bogus type character (%c) in tracefile %s\n", type[0], filename);
             appl_error(msg);
@@ -125,4 +135,36 @@ void free_trace(trace_t *trace)
     free(trace->ops);         /* free the two arrays... */
     free(trace->blocks);      
     free(trace);              /* and the trace record itself... */
-}
\ No newline at end of file
+}
+
+/*
+ * open_json - Opens the file -j results are appended to, one JSON object
+ * per line. Several processes may append to the same file.
+ */
+FILE *open_json(const char *path)
+{
+    FILE *out = fopen(path, "a");
+    if (out == NULL) {
+        sprintf(msg, "Could not open %s for the JSON results", path);
+        appl_error(msg);
+    }
+    return out;
+}
+
+/*
+ * write_json_string - Writes s as a quoted JSON string.
+ */
+void write_json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(out, "\\%c", *s);
+        } else if ((unsigned char) *s < 0x20) {
+            fprintf(out, "\\u%04x", *s);
+        } else {
+            fputc(*s, out);
+        }
+    }
+    fputc('"', out);
+}
@@ -33,9 +33,9 @@ typedef struct {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE} type; /* type of request */
+    enum {ALLOC, FREE, REALLOC} type; /* type of request */
     int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc request */
+    int size;                         /* byte size of alloc or realloc request */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -46,7 +46,11 @@ typedef struct {
     allocated_block_t *blocks; /* array of blocks returned by umalloc */
 } trace_t;
 
+extern char msg[MAXLINE]; /* scratch buffer for composing error messages */
+
 void appl_error(char *msg);
 void malloc_error(int opnum, char *msg);
 trace_t *read_trace(char *filename, int verbose);
-void free_trace(trace_t *trace);
\ No newline at end of file
+void free_trace(trace_t *trace);
+FILE *open_json(const char *path);
+void write_json_string(FILE *out, const char *s);
\ No newline at end of file
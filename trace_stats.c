@@ -0,0 +1,243 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * trace_stats.c - Offline analysis of traces. For every trace reports the op
+ * mix, a histogram of request sizes, how long blocks live, the peak of live
+ * bytes and a lower bound on the heap any allocator needs to replay it.
+ *
+ * The bound is the peak of the live payloads rounded up to ALIGNMENT, since
+ * every payload must start on an aligned address. No allocator can do better,
+ * so requested / bound is the best utilization runner can ever report for the
+ * trace. The same bound with umalloc's block headers added shows what is
+ * left once the header is paid for. Finding the true optimum is NP-hard, so
+ * an allocator may not be able to reach either bound.
+ *
+ * Usage: trace_stats [-hs] [-j file] trace...
+ **************************************************************************/
+
+#include "umalloc.h"
+#include "support.h"
+
+#define NUM_BUCKETS 20 /* power of two buckets, the last one is open ended */
+#define BAR_WIDTH 40
+
+/* Everything gathered about one trace in a single pass */
+typedef struct {
+    long ops[3];               /* indexed by the traceop_t type */
+    long sizes[NUM_BUCKETS];   /* alloc and realloc requests by size */
+    long lifetimes[NUM_BUCKETS]; /* freed blocks by ops between alloc and free */
+    long never_freed;
+    size_t peak_requested;     /* the most requested bytes live at once */
+    size_t peak_aligned;       /* the most aligned payload bytes live at once */
+    size_t peak_headers;       /* the same with a umalloc header per block */
+    long peak_blocks;
+} trace_stats_t;
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: trace_stats [-hs] [-j file] trace...\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-s         Print only the summary table.\n");
+    fprintf(stderr, "\t-j file    Append each trace's peak and utilization bounds to file as a JSON line.\n");
+}
+
+/*
+ * bucket_of - the power of two bucket holding value, bucket 0 is [0, 16].
+ */
+static int bucket_of(size_t value) {
+    int bucket = 0;
+    for (size_t bound = 16; value > bound && bucket < NUM_BUCKETS - 1; bound <<= 1) {
+        bucket++;
+    }
+    return bucket;
+}
+
+/*
+ * analyze - replays the trace's bookkeeping without allocating anything.
+ */
+static void analyze(trace_t *trace, trace_stats_t *stats) {
+    long *born = malloc(trace->num_ids * sizeof(long));
+    size_t *sizes = calloc(trace->num_ids, sizeof(size_t));
+    if (born == NULL || sizes == NULL) {
+        appl_error("Failed to allocate trace bookkeeping");
+    }
+    for (int id = 0; id < trace->num_ids; id++) {
+        born[id] = -1;
+    }
+
+    size_t requested = 0, aligned = 0, headers = 0;
+    long blocks = 0;
+    memset(stats, 0, sizeof(*stats));
+    for (long op = 0; op < trace->num_ops; op++) {
+        traceop_t *curr = &trace->ops[op];
+        int id = curr->index;
+        stats->ops[curr->type]++;
+
+        //take the id's old size out, a realloc puts the new one back
+        if (born[id] >= 0) {
+            requested -= sizes[id];
+            aligned -= ALIGN(sizes[id]);
+            headers -= ALIGN(sizes[id]) + HEADER_SIZE;
+            blocks--;
+        }
+        if (curr->type == FREE) {
+            if (born[id] >= 0) {
+                stats->lifetimes[bucket_of(op - born[id])]++;
+            }
+            born[id] = -1;
+            continue;
+        }
+
+        if (born[id] < 0) {
+            born[id] = op;
+        }
+        sizes[id] = curr->size;
+        stats->sizes[bucket_of(curr->size)]++;
+        requested += sizes[id];
+        aligned += ALIGN(sizes[id]);
+        headers += ALIGN(sizes[id]) + HEADER_SIZE;
+        blocks++;
+
+        stats->peak_requested = requested > stats->peak_requested ? requested : stats->peak_requested;
+        stats->peak_aligned = aligned > stats->peak_aligned ? aligned : stats->peak_aligned;
+        stats->peak_headers = headers > stats->peak_headers ? headers : stats->peak_headers;
+        stats->peak_blocks = blocks > stats->peak_blocks ? blocks : stats->peak_blocks;
+    }
+    for (int id = 0; id < trace->num_ids; id++) {
+        stats->never_freed += born[id] >= 0;
+    }
+    free(born);
+    free(sizes);
+}
+
+/*
+ * print_histogram - one line per non empty bucket with a bar scaled to the
+ * fullest bucket.
+ */
+static void print_histogram(const char *title, const char *unit, long *counts) {
+    long total = 0, most = 0;
+    int last = -1;
+    for (int bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+        total += counts[bucket];
+        most = counts[bucket] > most ? counts[bucket] : most;
+        last = counts[bucket] ? bucket : last;
+    }
+    printf("  %s\n", title);
+    if (total == 0) {
+        printf("    (none)\n");
+        return;
+    }
+
+    for (int bucket = 0; bucket <= last; bucket++) {
+        char range[32];
+        size_t high = (size_t) 16 << bucket;
+        if (bucket == 0) {
+            snprintf(range, sizeof(range), "<= %lu", high);
+        } else if (bucket == NUM_BUCKETS - 1) {
+            snprintf(range, sizeof(range), "> %lu", high >> 1);
+        } else {
+            snprintf(range, sizeof(range), "%lu-%lu", (high >> 1) + 1, high);
+        }
+        int width = (counts[bucket] * BAR_WIDTH + most - 1) / most;
+        printf("    %16s %-6s %8ld %5.1f%% %.*s\n", range, unit, counts[bucket],
+               100.0 * counts[bucket] / total, width, "########################################");
+    }
+}
+
+/*
+ * print_details - everything analyze found out about one trace.
+ */
+static void print_details(const char *name, trace_t *trace, trace_stats_t *stats) {
+    printf("%s: %d ids, %d ops\n", name, trace->num_ids, trace->num_ops);
+    printf("  op mix: %ld alloc (%.1f%%), %ld free (%.1f%%), %ld realloc (%.1f%%)\n",
+           stats->ops[ALLOC], 100.0 * stats->ops[ALLOC] / trace->num_ops,
+           stats->ops[FREE], 100.0 * stats->ops[FREE] / trace->num_ops,
+           stats->ops[REALLOC], 100.0 * stats->ops[REALLOC] / trace->num_ops);
+    print_histogram("request sizes", "bytes", stats->sizes);
+    print_histogram("lifetimes of freed blocks", "ops", stats->lifetimes);
+    if (stats->never_freed) {
+        printf("    %ld blocks are never freed\n", stats->never_freed);
+    }
+    printf("  peak live: %lu bytes requested in %ld blocks\n", stats->peak_requested, stats->peak_blocks);
+    printf("  heap lower bound: %lu bytes aligned, %lu with umalloc headers\n", stats->peak_aligned,
+           stats->peak_headers);
+    printf("  best utilization: %.2f%% for any allocator, %.2f%% with umalloc headers\n\n",
+           stats->peak_aligned ? 100.0 * stats->peak_requested / stats->peak_aligned : 0.0,
+           stats->peak_headers ? 100.0 * stats->peak_requested / stats->peak_headers : 0.0);
+}
+
+/*
+ * write_json_stats - Appends the summary row of one trace to the -j file.
+ */
+static void write_json_stats(const char *path, const char *name, trace_stats_t *stats) {
+    FILE *out = open_json(path);
+    fprintf(out, "{\"tool\": \"trace_stats\", \"trace\": ");
+    write_json_string(out, name);
+    fprintf(out, ", \"peak_requested\": %lu, \"peak_aligned\": %lu, \"peak_headers\": %lu, "
+            "\"best_utilization\": %.2f, \"best_utilization_headers\": %.2f}\n",
+            stats->peak_requested, stats->peak_aligned, stats->peak_headers,
+            stats->peak_aligned ? 100.0 * stats->peak_requested / stats->peak_aligned : 0.0,
+            stats->peak_headers ? 100.0 * stats->peak_requested / stats->peak_headers : 0.0);
+    fclose(out);
+}
+
+int main(int argc, char **argv) {
+    char c;
+    bool summary_only = false;
+    char *json_path = NULL;
+
+    while ((c = getopt(argc, argv, "hsj:")) != EOF) {
+        switch (c) {
+        case 's':
+            summary_only = true;
+            break;
+        case 'j':
+            json_path = optarg;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+
+    if (optind >= argc) {
+        usage();
+        appl_error("No trace files given.");
+    }
+
+    int num_traces = argc - optind;
+    trace_stats_t *all = calloc(num_traces, sizeof(trace_stats_t));
+    if (all == NULL) {
+        appl_error("Failed to allocate trace stats");
+    }
+    for (int i = 0; i < num_traces; i++) {
+        trace_t *trace = read_trace(argv[optind + i], 0);
+        analyze(trace, &all[i]);
+        if (!summary_only) {
+            print_details(argv[optind + i], trace, &all[i]);
+        }
+        free_trace(trace);
+    }
+
+    printf("%-32s %12s %12s %12s %10s %10s\n", "trace", "peak live", "bound", "w/ headers", "best %",
+           "w/ hdr %");
+    for (int i = 0; i < num_traces; i++) {
+        trace_stats_t *stats = &all[i];
+        printf("%-32s %12lu %12lu %12lu %10.2f %10.2f\n", argv[optind + i], stats->peak_requested,
+               stats->peak_aligned, stats->peak_headers,
+               stats->peak_aligned ? 100.0 * stats->peak_requested / stats->peak_aligned : 0.0,
+               stats->peak_headers ? 100.0 * stats->peak_requested / stats->peak_headers : 0.0);
+        if (json_path) {
+            write_json_stats(json_path, argv[optind + i], stats);
+        }
+    }
+    free(all);
+    return 0;
+}
@@ -0,0 +1,103 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+# Realloc heavy traces.
+#
+# realloc.rep  - a buffer grows by 128 bytes per step while short lived
+#                128 byte blocks are allocated and freed around it, like a
+#                vector appending between other work. Every 400 steps the
+#                buffer is dropped and a new one started, umalloc can't hand
+#                out blocks much past 64 KB.
+# realloc2.rep - the same with a 4092 byte buffer growing by 5 bytes and
+#                16 byte neighbours, most steps fit in the block's slack.
+# realloc3.rep - a pool of live buffers, each step grows, shrinks or
+#                replaces a random one, like strings being edited.
+
+srand(429);
+
+sub gen_growing {
+    my ($out_filename, $start_size, $step, $small_size, $num_iters, $num_buffers) = @_;
+    open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+    # ids 0..num_iters-1 are the neighbours, the buffers come after them
+    $num_blocks = $num_iters + $num_buffers;
+    $num_ops = 3*$num_iters + 2*$num_buffers;
+    $steps = $num_iters / $num_buffers;
+    print OUTFILE "$num_blocks\n";
+    print OUTFILE "$num_ops\n";
+
+    for ($i = 0;  $i < $num_iters; $i += 1) {
+        $buffer = $num_iters + int($i / $steps);
+        if ($i % $steps == 0) {
+            if ($i > 0) {
+                $prev = $buffer - 1;
+                print OUTFILE "f $prev\n";
+            }
+            $size = $start_size;
+            print OUTFILE "a $buffer $size\n";
+        }
+        print OUTFILE "a $i $small_size\n";
+        $size += $step;
+        print OUTFILE "r $buffer $size\n";
+        # each neighbour lives until the next one is allocated
+        if ($i > 0) {
+            $prev = $i - 1;
+            print OUTFILE "f $prev\n";
+        }
+    }
+    $last = $num_iters - 1;
+    print OUTFILE "f $last\n";
+    $last = $num_blocks - 1;
+    print OUTFILE "f $last\n";
+    close OUTFILE;
+}
+
+sub gen_editing {
+    my ($out_filename, $num_live, $num_steps, $max_size) = @_;
+    my @ops;
+    my @live;
+    my @sizes;
+
+    # every live slot holds an id, replacing a buffer frees it and takes a
+    # fresh id so ids are never reused
+    $next_id = 0;
+    for ($i = 0; $i < $num_live; $i += 1) {
+        $sizes[$next_id] = 1 + int(rand $max_size / 4);
+        push @ops, "a $next_id $sizes[$next_id]";
+        $live[$i] = $next_id++;
+    }
+    for ($i = 0; $i < $num_steps; $i += 1) {
+        $slot = int(rand $num_live);
+        $id = $live[$slot];
+        $pick = int(rand 10);
+        if ($pick < 6) {
+            $sizes[$id] += 1 + int(rand 256);
+            $sizes[$id] = $max_size if $sizes[$id] > $max_size;
+            push @ops, "r $id $sizes[$id]";
+        } elsif ($pick < 9) {
+            $sizes[$id] = 1 + int(rand $sizes[$id]);
+            push @ops, "r $id $sizes[$id]";
+        } else {
+            push @ops, "f $id";
+            $sizes[$next_id] = 1 + int(rand $max_size / 4);
+            push @ops, "a $next_id $sizes[$next_id]";
+            $live[$slot] = $next_id++;
+        }
+    }
+    foreach $id (@live) {
+        push @ops, "f $id";
+    }
+
+    open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+    $num_ops = @ops;
+    print OUTFILE "$next_id\n";
+    print OUTFILE "$num_ops\n";
+    foreach $op (@ops) {
+        print OUTFILE "$op\n";
+    }
+    close OUTFILE;
+}
+
+gen_growing("realloc.rep", 512, 128, 128, 4800, 12);
+gen_growing("realloc2.rep", 4092, 5, 16, 4800, 1);
+gen_editing("realloc3.rep", 200, 12000, 16384);
@@ -0,0 +1,115 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * uallocator.hpp - C++ adapters over umalloc. UAllocator<T> plugs umalloc
+ * into the standard containers and UMallocResource into the std::pmr ones.
+ * uinit must have run before either hands out memory.
+ **************************************************************************/
+
+#ifndef UALLOCATOR_HPP
+#define UALLOCATOR_HPP
+
+#include "umalloc.h"
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+
+namespace umalloc_cpp {
+
+/*
+ * allocate_bytes - umalloc for alignments up to ALIGNMENT, umemalign past
+ * it. Throws std::bad_alloc when the heap can't grow.
+ */
+inline void *allocate_bytes(std::size_t bytes, std::size_t alignment) {
+    void *ptr = alignment <= ALIGNMENT ? umalloc(bytes) : umemalign(alignment, bytes);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+/*
+ * UAllocator - A stateless standard allocator over umalloc. Every instance
+ * shares the one heap, so any two compare equal and containers can move and
+ * swap their memory freely.
+ */
+template <typename T>
+class UAllocator {
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::true_type;
+
+    template <typename U>
+    struct rebind {
+        using other = UAllocator<U>;
+    };
+
+    UAllocator() noexcept = default;
+    template <typename U>
+    UAllocator(const UAllocator<U> &) noexcept {}
+
+    T *allocate(size_type n) {
+        if (n > max_size()) {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T *>(allocate_bytes(n * sizeof(T), alignof(T)));
+    }
+
+    // Sized deallocation, the size is already in the block's header
+    void deallocate(T *ptr, size_type) noexcept {
+        ufree(ptr);
+    }
+
+    size_type max_size() const noexcept {
+        return std::numeric_limits<size_type>::max() / sizeof(T);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const UAllocator<T> &, const UAllocator<U> &) noexcept {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const UAllocator<T> &, const UAllocator<U> &) noexcept {
+    return false;
+}
+
+/*
+ * UMallocResource - A std::pmr::memory_resource over umalloc. Resources
+ * are interchangeable, memory from one may be released through another.
+ */
+class UMallocResource : public std::pmr::memory_resource {
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        return allocate_bytes(bytes, alignment);
+    }
+
+    void do_deallocate(void *ptr, std::size_t, std::size_t) override {
+        ufree(ptr);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return dynamic_cast<const UMallocResource *>(&other) != nullptr;
+    }
+};
+
+/*
+ * umalloc_resource - the process wide UMallocResource, the umalloc
+ * counterpart of std::pmr::new_delete_resource.
+ */
+inline std::pmr::memory_resource *umalloc_resource() noexcept {
+    static UMallocResource resource;
+    return &resource;
+}
+
+} // namespace umalloc_cpp
+
+#endif /* UALLOCATOR_HPP */
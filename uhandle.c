@@ -0,0 +1,241 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * uhandle.c - Relocatable objects and incremental heap compaction. A handle
+ * is an index into a table of payload pointers, so an object nobody has
+ * pinned can be slid down into the free space below it, or moved into a
+ * hole further down, and only its table slot has to change. Doing that to
+ * every movable object pushes the free space up to the end of the heap,
+ * where it is given back.
+ *
+ * The table holds each object's payload pointer as umalloc returned it, so
+ * a handle object costs no more than a plain one. Objects that are pinned,
+ * sampled by heapprof or sit above a block umalloc can't move stay where
+ * they are.
+ **************************************************************************/
+
+#define _GNU_SOURCE
+#include "umalloc.h"
+#include <assert.h>
+#include <sys/mman.h>
+
+extern heap_arena_t arenas[NUM_HEAPS];
+
+/* One slot of the handle table, free slots are linked through next_free */
+typedef struct {
+    void *ptr;          //what uhandle_pin returns, NULL while the slot is free
+    uint32_t pins;
+    uint32_t next_free;
+} handle_entry_t;
+
+// The handle table. Slot 0 is never handed out, so UHANDLE_NULL can't name
+// an object. Guarded by handle_lock, which is taken before an arena's lock.
+static handle_entry_t *handles = NULL;
+static uint32_t handle_capacity = 0;
+static uint32_t handle_count = 1; //slots handed out so far, counting slot 0
+static uint32_t free_handles = UHANDLE_NULL;
+static pthread_mutex_t handle_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The slot the next compaction step starts at, and whether the pass that
+// step belongs to has moved anything yet.
+static uint32_t compact_cursor = 1;
+static bool compact_moved = false;
+
+/*
+ * uhandle_reset - forgets every handle, called by uinit along with the heap
+ * they pointed into. The table's mapping is kept for reuse.
+ */
+void uhandle_reset() {
+    handle_count = 1;
+    free_handles = UHANDLE_NULL;
+    compact_cursor = 1;
+    compact_moved = false;
+}
+
+/*
+ * take_slot - a free slot for a new handle, growing the table when every
+ * slot is taken. Returns UHANDLE_NULL if the table can't grow. Caller holds
+ * handle_lock.
+ */
+static uhandle_t take_slot() {
+    if (free_handles != UHANDLE_NULL) {
+        uhandle_t handle = free_handles;
+        free_handles = handles[handle].next_free;
+        return handle;
+    }
+    if (handle_count >= handle_capacity) {
+        uint32_t capacity = handle_capacity ? handle_capacity * 2 : UHANDLE_MIN_CAPACITY;
+        void *grown;
+        if (!handles) {
+            grown = mmap(NULL, capacity * sizeof(handle_entry_t), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        } else {
+            grown = mremap(handles, handle_capacity * sizeof(handle_entry_t),
+                           capacity * sizeof(handle_entry_t), MREMAP_MAYMOVE);
+        }
+        if (grown == MAP_FAILED) {
+            return UHANDLE_NULL;
+        }
+        handles = grown;
+        handle_capacity = capacity;
+    }
+    return handle_count++;
+}
+
+/*
+ * get_entry - the table slot of a live handle. Caller holds handle_lock.
+ */
+static handle_entry_t *get_entry(uhandle_t handle) {
+    assert(handle != UHANDLE_NULL && handle < handle_count);
+    assert(handles[handle].ptr != NULL);
+    return &handles[handle];
+}
+
+/*
+ * uhandle_alloc - allocates a relocatable object of size bytes. Returns
+ * UHANDLE_NULL if the heap or the handle table could not grow.
+ */
+uhandle_t uhandle_alloc(size_t size) {
+    void *payload = umalloc(size);
+    if (!payload) {
+        return UHANDLE_NULL;
+    }
+
+    pthread_mutex_lock(&handle_lock);
+    uhandle_t handle = take_slot();
+    if (handle != UHANDLE_NULL) {
+        handles[handle].ptr = payload;
+        handles[handle].pins = 0;
+    }
+    pthread_mutex_unlock(&handle_lock);
+
+    if (handle == UHANDLE_NULL) {
+        ufree(payload);
+    }
+    return handle;
+}
+
+/*
+ * uhandle_pin - returns the object's current address and keeps it there
+ * until a matching uhandle_unpin. Pins nest.
+ */
+void *uhandle_pin(uhandle_t handle) {
+    pthread_mutex_lock(&handle_lock);
+    handle_entry_t *entry = get_entry(handle);
+    entry->pins++;
+    void *ptr = entry->ptr;
+    pthread_mutex_unlock(&handle_lock);
+    return ptr;
+}
+
+/*
+ * uhandle_unpin - lets compaction move the object again once every pin is
+ * released. Pointers from uhandle_pin must not be used afterwards.
+ */
+void uhandle_unpin(uhandle_t handle) {
+    pthread_mutex_lock(&handle_lock);
+    handle_entry_t *entry = get_entry(handle);
+    assert(entry->pins > 0);
+    entry->pins--;
+    pthread_mutex_unlock(&handle_lock);
+}
+
+/*
+ * uhandle_free - frees the object and recycles its handle. UHANDLE_NULL is
+ * ignored.
+ */
+void uhandle_free(uhandle_t handle) {
+    if (handle == UHANDLE_NULL) {
+        return;
+    }
+    pthread_mutex_lock(&handle_lock);
+    handle_entry_t *entry = get_entry(handle);
+    assert(entry->pins == 0);
+    void *payload = entry->ptr;
+    entry->ptr = NULL;
+    entry->next_free = free_handles;
+    free_handles = handle;
+    pthread_mutex_unlock(&handle_lock);
+
+    ufree(payload);
+}
+
+/*
+ * flush_arenas - consolidates the fast bins and remote frees of every arena
+ * so the blocks parked there count as free space objects may slide into,
+ * and once a pass is done, trims the end of the heap.
+ */
+static void flush_arenas(bool trim) {
+    for (int i = 0; i < NUM_HEAPS; i++) {
+        heap_arena_t *arena = &arenas[i];
+        if (!arena->regions) {
+            continue;
+        }
+        pthread_mutex_lock(&arena->lock);
+        collect_remote_frees(arena);
+        consolidate(arena);
+        if (trim) {
+            trim_heap(arena);
+        }
+        pthread_mutex_unlock(&arena->lock);
+    }
+}
+
+/*
+ * uhandle_compact - one bounded step of compaction, meant to run between
+ * requests. Walks the handle table from where the last step stopped and
+ * slides each unpinned object down into a free block right below it, or
+ * moves it into a free block lower in the heap, until about budget bytes
+ * have been copied or looked at, a table slot or free block looked at
+ * counting as its header's worth. A pass over the whole table that moves
+ * nothing trims the heap and ends the compaction. Returns true while there
+ * is more to do, calls after that start a new compaction.
+ */
+bool uhandle_compact(size_t budget) {
+    pthread_mutex_lock(&handle_lock);
+    if (compact_cursor == 1) {
+        flush_arenas(false);
+    }
+
+    bool more = true;
+    for (size_t spent = 0; spent < budget; spent += sizeof(handle_entry_t)) {
+        if (compact_cursor >= handle_count) {
+            compact_cursor = 1;
+            if (!compact_moved) {
+                flush_arenas(true);
+                more = false;
+                break;
+            }
+            compact_moved = false;
+            flush_arenas(false);
+        }
+
+        handle_entry_t *entry = &handles[compact_cursor++];
+        if (!entry->ptr || entry->pins) {
+            continue;
+        }
+        memory_block_t *block = get_block(entry->ptr);
+        //heapprof knows a sampled block by its address, so it stays put
+        if (block->next != MAGIC_NUM) {
+            continue;
+        }
+
+        heap_arena_t *arena = get_arena(block);
+        size_t scanned = 0;
+        pthread_mutex_lock(&arena->lock);
+        memory_block_t *moved = slide_down(arena, block);
+        if (!moved) {
+            //the search for a lower block is paid for out of what is left
+            moved = move_lower(arena, block, (budget - spent) / HEADER_SIZE, &scanned);
+        }
+        pthread_mutex_unlock(&arena->lock);
+        spent += scanned * HEADER_SIZE;
+        if (moved) {
+            entry->ptr = get_payload(moved);
+            spent += get_size(moved);
+            compact_moved = true;
+        }
+    }
+    pthread_mutex_unlock(&handle_lock);
+    return more;
+}
@@ -1,8 +1,13 @@
 #include "umalloc.h"
 #include "csbrk.h"
 #include "ansicolors.h"
+#include "size_classes.h"
+#include "heapprof.h"
 #include <stdio.h>
 #include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
 
 const char author[] = ANSI_BOLD ANSI_COLOR_RED "Jake Medina jrm7784" ANSI_RESET;
 
@@ -11,8 +16,99 @@ const char author[] = ANSI_BOLD ANSI_COLOR_RED "Jake Medina jrm7784" ANSI_RESET;
  * struct, they can be adjusted as necessary.
  */
 
-// A pointer to the HEADER NODE of the free list.
-memory_block_t *free_head;
+// The arenas. Arena 0 is the main arena that uinit seeds with the initial
+// block, and the one a single threaded program always uses. SHORT_ARENA is
+// never a thread's own, every thread allocates short-lived objects from it.
+heap_arena_t arenas[NUM_HEAPS];
+
+// Guards arena assignment, arenas[i].threads is only changed under it.
+pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// csbrk is not thread safe and the break is shared by every arena.
+pthread_mutex_t sbrk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Where the heap gets memory from, csbrk or chuge in huge page mode. Picked
+// by uinit and called under sbrk_lock.
+static void *(*morecore)(intptr_t increment) = csbrk;
+static bool use_hugepages = false;
+
+// The persistent heap file uinit maps instead of the break, NULL for none.
+static const char *persist_path = NULL;
+static size_t persist_capacity = 0;
+static persist_header_t *persist = NULL;
+
+// Linked into the harnesses only, a reattached heap is checked when present.
+int check_heap() __attribute__((weak));
+
+// How many cache line offsets extend rotates new slabs through, see
+// color_slab. Read from UMALLOC_COLORS by uinit.
+static unsigned num_colors = NUM_COLORS;
+
+// How find searches a class for its best fit, resolved by uinit.
+static free_search_t free_search = FREE_SEARCH_AUTO;
+
+// How find places requests, see placement_t. Every arena starts out with it,
+// or with best fit when it is PLACEMENT_ADAPTIVE. Read from UMALLOC_PLACEMENT
+// by uinit.
+static placement_t placement = PLACEMENT_BEST_FIT;
+
+// Whether plain umalloc calls are routed by a predicted lifetime, see
+// lifetime.c. Set from UMALLOC_LIFETIME by uinit.
+static bool predict_lifetimes = false;
+
+// Bytes asked for as short-lived since uinit. SHORT_ARENA is left alone
+// until they reach SHORT_ARENA_MIN, before that a region of its own would
+// mostly be slab and region headers.
+static UMALLOC_ATOMIC(size_t) short_bytes = 0;
+
+// Phase timers, compiled out unless built with -DUMALLOC_PHASES. Each phase
+// is charged to the arena whose lock the caller holds.
+#ifdef UMALLOC_PHASES
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PHASE_TICKS "cycles"
+#define phase_clock() __rdtsc()
+#else
+#include <time.h>
+#define PHASE_TICKS "ns"
+static inline uint64_t phase_clock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+#endif
+#define PHASE_START(start) uint64_t start = phase_clock()
+#define PHASE_END(arena, phase, start) \
+    do { \
+        (arena)->phases[phase].calls++; \
+        (arena)->phases[phase].ticks += phase_clock() - (start); \
+    } while (0)
+#define PHASE_ITEMS(arena, phase, n) ((arena)->phases[phase].items += (n))
+#else
+#define PHASE_START(start)
+#define PHASE_END(arena, phase, start) ((void) 0)
+#define PHASE_ITEMS(arena, phase, n) ((void) 0)
+#endif
+
+/*
+ * thread_cache_t - Per thread quick lists of small blocks owned by the
+ * thread's arena. They are only touched by their own thread, so the fast
+ * path needs no locks. Aligned so a thread's cache never shares a cache
+ * line with anything another thread writes.
+ */
+typedef struct {
+    heap_arena_t *arena; //the arena this thread allocates from
+    memory_block_t *bins[NUM_TCACHE_BINS];
+    unsigned counts[NUM_TCACHE_BINS];
+    int64_t until_sample; //bytes the thread allocates before heapprof samples
+    int64_t until_track; //allocations before the lifetime predictor follows one
+} __attribute__((aligned(CACHE_LINE))) thread_cache_t;
+
+__thread thread_cache_t tcache;
+
+// Used to flush a thread's cache and release its arena when it exits.
+pthread_key_t tcache_key;
+pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
 
 // A pointer to the start of the allocated list.
 memory_block_t *alloc_head;
@@ -27,7 +123,7 @@ bool alloc_list = false;
  */
 bool is_allocated(memory_block_t *block) {
     assert(block != NULL);
-    return block->block_size_alloc & 0x1;
+    return block->block_size_alloc & BLOCK_ALLOC;
 }
 
 /*
@@ -35,7 +131,7 @@ bool is_allocated(memory_block_t *block) {
  */
 void allocate(memory_block_t *block) {
     assert(block != NULL);
-    block->block_size_alloc |= 0x1;
+    block->block_size_alloc |= BLOCK_ALLOC;
 }
 
 
@@ -44,7 +140,7 @@ void allocate(memory_block_t *block) {
  */
 void deallocate(memory_block_t *block) {
     assert(block != NULL);
-    block->block_size_alloc &= ~0x1;
+    block->block_size_alloc &= ~BLOCK_ALLOC;
 }
 
 /*
@@ -55,6 +151,38 @@ size_t get_size(memory_block_t *block) {
     return block->block_size_alloc & ~(ALIGNMENT-1);
 }
 
+/*
+ * set_size - changes the size of the block, keeping its flag bits.
+ */
+static void set_size(memory_block_t *block, size_t size) {
+    assert(size % ALIGNMENT == 0);
+    block->block_size_alloc = size | (block->block_size_alloc & (ALIGNMENT-1));
+}
+
+/*
+ * is_first - returns true if the block starts a contiguous heap region.
+ */
+bool is_first(memory_block_t *block) {
+    assert(block != NULL);
+    return block->block_size_alloc & BLOCK_FIRST;
+}
+
+/*
+ * is_last - returns true if the block ends a contiguous heap region.
+ */
+bool is_last(memory_block_t *block) {
+    assert(block != NULL);
+    return block->block_size_alloc & BLOCK_LAST;
+}
+
+/*
+ * is_fast - returns true if the block is sitting in a fast bin.
+ */
+bool is_fast(memory_block_t *block) {
+    assert(block != NULL);
+    return block->block_size_alloc & BLOCK_FAST;
+}
+
 /*
  * get_next - gets the next block.
  */
@@ -63,10 +191,54 @@ memory_block_t *get_next(memory_block_t *block) {
     return block->next;
 }
 
+/*
+ * get_phys_next - gets the block physically after this one, or NULL if the
+ * block ends its region.
+ */
+memory_block_t *get_phys_next(memory_block_t *block) {
+    assert(block != NULL);
+    if (is_last(block)) {
+        return NULL;
+    }
+    return (void *) block + HEADER_SIZE + get_size(block);
+}
+
+/*
+ * get_phys_prev - gets the block physically before this one, or NULL if the
+ * block starts its region.
+ */
+memory_block_t *get_phys_prev(memory_block_t *block) {
+    assert(block != NULL);
+    if (is_first(block)) {
+        return NULL;
+    }
+    return (void *) block - HEADER_SIZE - block->prev_size;
+}
+
+/*
+ * get_region_first - gets the first block of a region.
+ */
+memory_block_t *get_region_first(heap_region_t *region) {
+    assert(region != NULL);
+    return (memory_block_t *)(region + 1);
+}
+
+/*
+ * get_region_last - walks a region to its last block.
+ */
+static memory_block_t *get_region_last(heap_region_t *region) {
+    memory_block_t *block = get_region_first(region);
+    while (!is_last(block)) {
+        block = get_phys_next(block);
+    }
+    return block;
+}
+
 /*
  * put_block - puts a block struct into memory at the specified address.
- * Initializes the size and allocated fields, along with NUlling out the next 
- * field. Sets the block's prev field.
+ * Initializes the size and allocated fields, along with NUlling out the next
+ * field. Sets the block's prev field. Region flags and prev_size are left to
+ * the caller.
  */
 void put_block(memory_block_t *block, size_t size, memory_block_t *prev, bool alloc) {
     assert(block != NULL);
@@ -93,388 +265,1799 @@ memory_block_t *get_block(void *payload) {
     return ((memory_block_t *)payload) - 1;
 }
 
+/*
+ * get_size_class - maps a request size to its size class with a single load
+ * from the generated lookup table. Sizes past the table clamp to its last
+ * entry, which belongs to the unbounded class.
+ */
+int get_size_class(size_t size) {
+    size_t aligned = ALIGN(size);
+    size_t clamped = aligned < SIZE_CLASS_LOOKUP_MAX + ALIGNMENT ? aligned : SIZE_CLASS_LOOKUP_MAX + ALIGNMENT;
+    return size_class_lookup[clamped / ALIGNMENT];
+}
+
+/*
+ * insert_free - pushes a free block onto the front of its class's free list.
+ */
+void insert_free(heap_arena_t *arena, memory_block_t *block) {
+    PHASE_START(start);
+    assert(!is_allocated(block));
+    int class = get_size_class(get_size(block));
+
+    block->prev = NULL;
+    block->next = arena->free_lists[class];
+    if (block->next) {
+        block->next->prev = block;
+    }
+    arena->free_lists[class] = block;
+    index_insert(&arena->free_index[class], block);
+    PHASE_END(arena, PHASE_INSERT, start);
+}
+
+/*
+ * remove_free - unlinks a free block from its class's free list.
+ */
+void remove_free(heap_arena_t *arena, memory_block_t *block) {
+    assert(!is_allocated(block));
+    int class = get_size_class(get_size(block));
+
+    index_remove(&arena->free_index[class], block);
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        arena->free_lists[class] = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    block->next = NULL;
+    block->prev = NULL;
+}
+
+/*
+ * get_fastbin - maps a block size to its fast bin. Only valid for sizes up
+ * to FASTBIN_MAX.
+ */
+static int get_fastbin(size_t size) {
+    return ALIGN(size) / ALIGNMENT - 1;
+}
+
+/*
+ * consolidate - empties the fast bins. Every block is marked free, merged
+ * with its free neighbors and put on its size class's free list. Blocks
+ * next to one another in the bins merge as the later one is released.
+ */
+void consolidate(heap_arena_t *arena) {
+    for (int bin = 0; bin < NUM_FASTBINS; bin++) {
+        memory_block_t *cur = arena->fastbins[bin];
+        while (cur) {
+            memory_block_t *next = cur->next;
+            cur->block_size_alloc &= ~BLOCK_FAST;
+            deallocate(cur);
+            insert_free(arena, coalesce(arena, cur));
+            cur = next;
+        }
+        arena->fastbins[bin] = NULL;
+    }
+    arena->fastbin_count = 0;
+}
+
 /*
  * The following are helper functions that can be implemented to assist in your
- * design, but they are not required. 
+ * design, but they are not required.
  */
 
 /*
- * find - finds a free block that can satisfy the umalloc request.
+ * best_fit - the smallest free block in a class with at least size bytes,
+ * NULL if none fits. Scans the class's packed size index unless the list
+ * walk was asked for or the index is broken. Adds the blocks looked at to
+ * scanned, as every fit below does.
  */
-memory_block_t *find(size_t size) {
+static memory_block_t *best_fit(heap_arena_t *arena, int class, size_t size, size_t *scanned) {
+    free_index_t *index = &arena->free_index[class];
+    if (free_search != FREE_SEARCH_LIST && !index->broken) {
+        int64_t slot = index_best_fit(index, size, free_search);
+        //an exact fit ends the scan early
+        *scanned += slot >= 0 && index->sizes[slot] == size ? slot + 1 : index->count;
+        return slot < 0 ? NULL : index->blocks[slot];
+    }
 
-    //we must traverse through our free list to see if there is a fit
-    
-    //uses best-fit algorithm
-    
-    //use a pointer to point to the best (smallest) block we have found so far
     memory_block_t *best = NULL;
-    memory_block_t *cur = free_head->next;
-    
-    int requested_size = ALIGN(size);
-    //loop thru the entire free list
-    while(cur) {
+    for (memory_block_t *cur = arena->free_lists[class]; cur; cur = cur->next) {
         assert(!is_allocated(cur));
-        assert(cur != MAGIC_NUM);
-        //check if the malloc call will fit AND check if the size 
-        //is smaller than the previous best fit
-        if (get_size(cur) >= requested_size) {
-            //this malloc call will fit, is it a better fit than the previous block?
-            if (!best || get_size(cur) < get_size(best)) {
-                //this block is a better fit
-                best = cur;
+        (*scanned)++;
+        if (get_size(cur) >= size && (!best || get_size(cur) < get_size(best))) {
+            best = cur;
+            if (get_size(best) == size) {
+                break;
             }
-            //keep going until the end
         }
-        cur = cur->next;
     }
-
     return best;
 }
 
 /*
- * extend - extends the heap if more memory is required.
+ * good_fit - best fit that stops at the first block wasting less than
+ * 1/GOOD_FIT_SLACK of the request, so a long class is rarely read to its
+ * end.
  */
-memory_block_t *extend(size_t size) {
+static memory_block_t *good_fit(heap_arena_t *arena, int class, size_t size, size_t *scanned) {
+    size_t good = size + size / GOOD_FIT_SLACK;
+    free_index_t *index = &arena->free_index[class];
+    memory_block_t *best = NULL;
+    size_t best_size = SIZE_MAX;
+    if (free_search != FREE_SEARCH_LIST && !index->broken) {
+        for (uint32_t slot = 0; slot < index->count; slot++) {
+            (*scanned)++;
+            if (index->sizes[slot] >= size && index->sizes[slot] < best_size) {
+                best = index->blocks[slot];
+                best_size = index->sizes[slot];
+                if (best_size <= good) {
+                    break;
+                }
+            }
+        }
+        return best;
+    }
 
-    //creates a new block that will fit memory of [size]
+    for (memory_block_t *cur = arena->free_lists[class]; cur; cur = cur->next) {
+        (*scanned)++;
+        if (get_size(cur) >= size && get_size(cur) < best_size) {
+            best = cur;
+            best_size = get_size(cur);
+            if (best_size <= good) {
+                break;
+            }
+        }
+    }
+    return best;
+}
 
-    //NOTE: the memory from this method will NOT be added to the 
-    //free list because it's purpose is to be allocated immediately
+/*
+ * first_fit - the lowest addressed free block in a class that fits. The
+ * lists are kept in free order, so the whole class is read.
+ */
+static memory_block_t *first_fit(heap_arena_t *arena, int class, size_t size, size_t *scanned) {
+    free_index_t *index = &arena->free_index[class];
+    memory_block_t *first = NULL;
+    if (free_search != FREE_SEARCH_LIST && !index->broken) {
+        *scanned += index->count;
+        for (uint32_t slot = 0; slot < index->count; slot++) {
+            if (index->sizes[slot] >= size && (!first || index->blocks[slot] < first)) {
+                first = index->blocks[slot];
+            }
+        }
+        return first;
+    }
 
-    int EXTEND_SIZE = PAGESIZE * 3;
-    memory_block_t *new_block;
+    for (memory_block_t *cur = arena->free_lists[class]; cur; cur = cur->next) {
+        (*scanned)++;
+        if (get_size(cur) >= size && (!first || cur < first)) {
+            first = cur;
+        }
+    }
+    return first;
+}
 
-    if(size + HEADER_SIZE > EXTEND_SIZE) {
-        new_block = (memory_block_t *) csbrk(ALIGN(size + HEADER_SIZE));
-        // printf("extend, creating block of size %ld\n", ALIGN(size + HEADER_SIZE));
+/*
+ * next_fit - the first block that fits, reading the class's index from its
+ * rover and wrapping around to the start. The rover is left on the slot
+ * after the one found, so the next search picks up from there. Without the
+ * index the list is read from its head, which is first fit in free order.
+ */
+static memory_block_t *next_fit(heap_arena_t *arena, int class, size_t size, size_t *scanned) {
+    free_index_t *index = &arena->free_index[class];
+    if (free_search != FREE_SEARCH_LIST && !index->broken) {
+        uint32_t slot = arena->rovers[class] < index->count ? arena->rovers[class] : 0;
+        for (uint32_t i = 0; i < index->count; i++) {
+            (*scanned)++;
+            if (index->sizes[slot] >= size) {
+                arena->rovers[class] = slot + 1;
+                return index->blocks[slot];
+            }
+            slot = slot + 1 < index->count ? slot + 1 : 0;
+        }
+        return NULL;
+    }
 
-        new_block->block_size_alloc = ALIGN(size + HEADER_SIZE) - HEADER_SIZE;
-        // printf("block_size_alloc is %ld\n", get_size(new_block));
-    } else {
-        new_block = (memory_block_t *) csbrk(EXTEND_SIZE);
-        new_block->block_size_alloc = EXTEND_SIZE - HEADER_SIZE;
+    for (memory_block_t *cur = arena->free_lists[class]; cur; cur = cur->next) {
+        (*scanned)++;
+        if (get_size(cur) >= size) {
+            return cur;
+        }
     }
+    return NULL;
+}
 
-    new_block->prev = NULL;
-    new_block->next = NULL;
+/* Searches one class for a block of at least size bytes */
+typedef memory_block_t *(*class_fit_t)(heap_arena_t *arena, int class, size_t size, size_t *scanned);
 
-    return new_block;
+static const class_fit_t class_fits[] = {
+    [PLACEMENT_BEST_FIT] = best_fit,
+    [PLACEMENT_GOOD_FIT] = good_fit,
+    [PLACEMENT_FIRST_FIT] = first_fit,
+    [PLACEMENT_NEXT_FIT] = next_fit,
+};
+
+/*
+ * lowest_fit - first fit over every class a fitting block can be in. The
+ * lowest addressed block may sit in any of them, so each is searched.
+ */
+static memory_block_t *lowest_fit(heap_arena_t *arena, int class, size_t size, size_t *scanned) {
+    memory_block_t *lowest = NULL;
+    for (; class < NUM_SIZE_CLASSES; class++) {
+        memory_block_t *first = first_fit(arena, class, size, scanned);
+        if (first && (!lowest || first < lowest)) {
+            lowest = first;
+        }
+    }
+    return lowest;
 }
 
 /*
- * split - splits a given block in parts, one FOR ALLOCATION, one free.
- * pre: size must be ALIGNMENT-byte aligned.
- * If the block does not have room to be split, return the same block.
+ * find_fit - uses the arena's placement policy inside the request's own
+ * class. Every block in a larger class is guaranteed to fit, so those
+ * classes just take their first block, except for the unbounded last class
+ * which is searched with the policy again. First fit is after an address
+ * order, not a size, so it reads every class that could hold a fit.
  */
-memory_block_t *split(memory_block_t *block, size_t size) {
+static memory_block_t *find_fit(heap_arena_t *arena, size_t size, size_t *scanned) {
+    size_t requested_size = ALIGN(size);
+    int class = get_size_class(requested_size);
+    class_fit_t fit = class_fits[arena->placement];
+    if (arena->placement == PLACEMENT_FIRST_FIT) {
+        return lowest_fit(arena, class, requested_size, scanned);
+    }
 
-    int requested_size = size + HEADER_SIZE; //we MUST have at least this total block size
-    int f_block_total_size = block->block_size_alloc + HEADER_SIZE - requested_size;
+    //the policy's pick inside the request's class
+    memory_block_t *best = fit(arena, class, requested_size, scanned);
+    if (best || class == NUM_SIZE_CLASSES - 1) {
+        return best;
+    }
 
-    printf("attempting to split this block of T_SIZE %ld\n", block->block_size_alloc + HEADER_SIZE);
-    printf("into size %d", requested_size);
-    printf("and %d\n", f_block_total_size);
+    //any block in a bounded larger class fits
+    for (class++; class < NUM_SIZE_CLASSES - 1; class++) {
+        if (arena->free_lists[class]) {
+            return arena->free_lists[class];
+        }
+    }
 
-    assert(!is_allocated(block));
-    assert(size % ALIGNMENT == 0);
-    
-    // if (f_block_total_size > 32) {
-    //     printf("splitting block...\n");
-    //     memory_block_t *f_block = (void *) block + requested_size; //portion of the block to be left unallocated
-    //     put_block(f_block, block->block_size_alloc - requested_size, block, false);
+    //the unbounded class may hold blocks of any size
+    return fit(arena, NUM_SIZE_CLASSES - 1, requested_size, scanned);
+}
+
+/*
+ * fragmentation - the percentage of an arena's memory that sits free on its
+ * lists, holes that placement has failed to fill. An arena with less than a
+ * page free counts as whole.
+ */
+static unsigned fragmentation(heap_arena_t *arena) {
+    size_t free_bytes = 0;
+    size_t heap_bytes = 0;
+    for (int class = 0; class < NUM_SIZE_CLASSES; class++) {
+        for (memory_block_t *cur = arena->free_lists[class]; cur; cur = cur->next) {
+            free_bytes += get_size(cur);
+        }
+    }
+    for (heap_region_t *region = arena->regions; region; region = region->next) {
+        heap_bytes += (char *) region->end - (char *) region;
+    }
+    return free_bytes < PAGESIZE ? 0 : 100 * free_bytes / heap_bytes;
+}
 
-    //     block->block_size_alloc = requested_size - HEADER_SIZE;
-    //     block->next = f_block;
+/*
+ * adapt_placement - picks the arena's policy for the next window from how
+ * the last one went. A fragmented heap goes back to best fit, which leaves
+ * the fewest slivers. Otherwise long searches step best or first fit down
+ * to good fit and then next fit, which look at fewer blocks and scatter
+ * more. Once searches are short again they step back up, next fit to first
+ * fit, which packs the heap toward low addresses, and good fit to best fit.
+ */
+static void adapt_placement(heap_arena_t *arena) {
+    uint64_t search = arena->window_scanned / arena->window_finds;
+    placement_t current = arena->placement;
+    if (fragmentation(arena) > PLACEMENT_FRAGMENTED) {
+        arena->placement = PLACEMENT_BEST_FIT;
+    } else if (search > PLACEMENT_LONG_SEARCH) {
+        bool cheap = current == PLACEMENT_GOOD_FIT || current == PLACEMENT_NEXT_FIT;
+        arena->placement = cheap ? PLACEMENT_NEXT_FIT : PLACEMENT_GOOD_FIT;
+    } else if (search < PLACEMENT_SHORT_SEARCH) {
+        if (current == PLACEMENT_NEXT_FIT) {
+            arena->placement = PLACEMENT_FIRST_FIT;
+        } else if (current == PLACEMENT_GOOD_FIT) {
+            arena->placement = PLACEMENT_BEST_FIT;
+        }
+    }
+    arena->window_finds = 0;
+    arena->window_scanned = 0;
+}
 
-    //     printf("successfully split block into P_SIZE %ld\n", block->block_size_alloc);
-    //     printf("and %ld\n", f_block->block_size_alloc);
-    // }
+/*
+ * find - finds a free block that can satisfy the umalloc request.
+ */
+memory_block_t *find(heap_arena_t *arena, size_t size) {
+    PHASE_START(start);
+    size_t scanned = 0;
+    memory_block_t *found = find_fit(arena, size, &scanned);
+    PHASE_ITEMS(arena, PHASE_FIND, scanned);
+    arena->window_scanned += scanned;
+    if (placement == PLACEMENT_ADAPTIVE && ++arena->window_finds == PLACEMENT_WINDOW) {
+        adapt_placement(arena);
+    }
+    PHASE_END(arena, PHASE_FIND, start);
+    return found;
+}
 
-    if (f_block_total_size > HEADER_SIZE) {
-        printf("splitting block...\n");
-        memory_block_t *f_block = (void *) block + requested_size; //portion of the block to be left unallocated
-        put_block(f_block, f_block_total_size - HEADER_SIZE, block, false);
+/*
+ * color_slab - Slabs are page multiples, so new regions tend to start on
+ * page boundaries and the n-th object carved from every small-object slab
+ * lands on the same cache sets. This moves the start of the slab in a new
+ * region's first block forward by a rotating number of cache lines, the
+ * skipped bytes become a free block of their own. slack is what the slab
+ * has beyond the request, a slab without room for the offset is left alone.
+ * Returns the block to allocate from.
+ */
+static memory_block_t *color_slab(heap_arena_t *arena, memory_block_t *block, size_t slack) {
+    if (num_colors <= 1) {
+        return block;
+    }
+    //color 0 is the plain layout, the rest are at least HEADER_SIZE + MIN_PAYLOAD
+    size_t offset = (arena->next_color++ % num_colors) * CACHE_LINE;
+    if (offset == 0 || offset > slack) {
+        return block;
+    }
 
-        f_block->next = block->next;
+    memory_block_t *slab = (void *) block + offset;
+    put_block(slab, get_size(block) - offset, NULL, false);
+    slab->prev_size = offset - HEADER_SIZE;
+    slab->block_size_alloc |= BLOCK_LAST;
+    set_size(block, offset - HEADER_SIZE);
+    block->block_size_alloc &= ~BLOCK_LAST;
+    insert_free(arena, block);
+    return slab;
+}
 
-        block->block_size_alloc = requested_size - HEADER_SIZE;
-        block->next = f_block;
+/*
+ * extend - extends the heap if more memory is required.
+ * Requests the class's slab size from csbrk (or exactly what is needed for
+ * the unbounded class). If csbrk hands back memory right after the arena's
+ * previous region, the region is grown in place and merged with a free last
+ * block. Otherwise the memory becomes a new region, headed by a heap_region_t.
+ * The returned block is free but NOT on a free list, because its purpose is
+ * to be allocated immediately.
+ */
+memory_block_t *extend(heap_arena_t *arena, size_t size) {
+    PHASE_START(start);
+    size_t needed = ALIGN(size) + HEADER_SIZE + REGION_HEADER_SIZE;
+    size_t slab = size_class_slab_sizes[get_size_class(size)];
+    size_t extend_size = needed > slab ? needed : slab;
+
+    if (extend_size > 16 * PAGESIZE) {
+        PHASE_END(arena, PHASE_EXTEND, start);
+        return NULL;
+    }
 
-        printf("successfully split block into P_SIZE %ld\n", block->block_size_alloc);
-        printf("and %ld\n", f_block->block_size_alloc);
+    pthread_mutex_lock(&sbrk_lock);
+    PHASE_START(core_start);
+    void *mem = morecore(extend_size);
+    PHASE_END(arena, PHASE_MORECORE, core_start);
+    PHASE_ITEMS(arena, PHASE_MORECORE, extend_size);
+    pthread_mutex_unlock(&sbrk_lock);
+    if (mem == NULL || mem == (void *) -1) {
+        PHASE_END(arena, PHASE_EXTEND, start);
+        return NULL;
     }
 
+    memory_block_t *new_block;
 
-    return block;
+    //an allocated last block may be in use by another thread, so only a free
+    //one is merged with, otherwise the new memory starts a region of its own
+    if (arena->heap_last && !is_allocated(arena->heap_last) && mem == arena->regions->end) {
+        //contiguous with the previous region, so hook into it
+        new_block = mem;
+        put_block(new_block, extend_size - HEADER_SIZE, NULL, false);
+        arena->heap_last->block_size_alloc &= ~BLOCK_LAST;
+        new_block->prev_size = get_size(arena->heap_last);
+        new_block->block_size_alloc |= BLOCK_LAST;
+        arena->regions->end = mem + extend_size;
+
+        new_block = coalesce(arena, new_block);
+    } else {
+        heap_region_t *region = mem;
+        region->next = arena->regions;
+        region->end = mem + extend_size;
+        arena->regions = region;
+
+        new_block = get_region_first(region);
+        put_block(new_block, extend_size - REGION_HEADER_SIZE - HEADER_SIZE, NULL, false);
+        new_block->prev_size = 0;
+        new_block->block_size_alloc |= BLOCK_FIRST | BLOCK_LAST;
+        new_block = color_slab(arena, new_block, extend_size - needed);
+    }
+
+    arena->heap_last = new_block;
+    PHASE_END(arena, PHASE_EXTEND, start);
+    return new_block;
 }
 
 /*
- * coalesce_prev - coalesces a free memory block with its previous neighbor.
+ * split - splits a given block in parts, one FOR ALLOCATION, one free.
+ * pre: size must be ALIGNMENT-byte aligned, block must not be on a free list.
+ * The free remainder is put back on its free list.
+ * If the block does not have room to be split, return the same block.
  */
-memory_block_t *coalesce_prev(memory_block_t *block) {
-    //we want to make sure we don't coalesce with the HEADER node!
-    // memory_block_t *c_block;
-    if(block->prev != free_head && (block->prev + HEADER_SIZE + block->prev->block_size_alloc == block)) {
-        assert(block->prev);
-        printf("coalescing prev...\n");
-        printf("BLOCK 1 T_SIZE = %ld\n", block->prev->block_size_alloc + HEADER_SIZE);
-        printf("BLOCK 2 T_SIZE = %ld\n", block->block_size_alloc + HEADER_SIZE);
-        printf("coalescing blocks with START/END address\n");
-        printf("&BLOCK 1 START = %p\n", (void *) block->prev);
-        printf("&BLOCK 1 END = %p\n", (void *) block->prev + HEADER_SIZE + block->prev->block_size_alloc);
-        // c_block = block->prev; //points to the beginning of the block before this one
+memory_block_t *split(heap_arena_t *arena, memory_block_t *block, size_t size) {
+    PHASE_START(start);
+    assert(size % ALIGNMENT == 0);
+    assert(get_size(block) >= size);
+
+    size_t remainder = get_size(block) - size;
+    if (remainder < HEADER_SIZE + MIN_PAYLOAD) {
+        PHASE_END(arena, PHASE_SPLIT, start);
+        return block;
+    }
 
-        printf("&BLOCK 2 START = %p\n", (void *) block);
-        printf("&BLOCK 2 END = %p\n", (void *) block + HEADER_SIZE + block->block_size_alloc);
+    memory_block_t *f_block = (void *) block + HEADER_SIZE + size; //portion of the block to be left unallocated
+    put_block(f_block, remainder - HEADER_SIZE, NULL, false);
+    f_block->prev_size = size;
 
-        block->prev->next = block->next;
-        if(block->next) {
-            block->next->prev = block->prev;
-        }
-        
-        //change the size of the prev block to include this one
-        block->prev->block_size_alloc = get_size(block->prev) + get_size(block) + HEADER_SIZE;
-
-        //remove the pointers from the block
-        //and change to a magic num for debugging
-        // block->prev = MAGIC_NUM_COALESCE;
-        // block->next = MAGIC_NUM_COALESCE;
-
-        printf("NEW BLOCK T_SIZE = %ld\n", block->prev->block_size_alloc + HEADER_SIZE);
-        printf("&NEW BLOCK START = %p\n", (void *) block->prev);
-        printf("&NEW BLOCK END = %p\n", (void *) block->prev + HEADER_SIZE + block->prev->block_size_alloc);
-        return block->prev;
+    //the remainder takes over the end of the region
+    if (is_last(block)) {
+        f_block->block_size_alloc |= BLOCK_LAST;
+        block->block_size_alloc &= ~BLOCK_LAST;
+        if (arena->heap_last == block) {
+            arena->heap_last = f_block;
+        }
     } else {
-        printf("no prev coalesce\n");
+        get_phys_next(f_block)->prev_size = get_size(f_block);
     }
-    //if the block was not coalesced, return the unchanged block
+    set_size(block, size);
+
+    insert_free(arena, f_block);
+    PHASE_END(arena, PHASE_SPLIT, start);
     return block;
 }
 
 /*
- * coalesce_next - coalesces a free memory block with its next neighbor.
+ * coalesce_prev - merges a free block into its physical predecessor if that
+ * block is free. The predecessor is taken off its free list.
  */
-memory_block_t *coalesce_next(memory_block_t *block) {
-    assert(!is_allocated(block));
+memory_block_t *coalesce_prev(heap_arena_t *arena, memory_block_t *block) {
+    memory_block_t *prev_block = get_phys_prev(block);
+    if (!prev_block || is_allocated(prev_block)) {
+        //if the block was not coalesced, return the unchanged block
+        return block;
+    }
+
+    remove_free(arena, prev_block);
+    set_size(prev_block, get_size(prev_block) + HEADER_SIZE + get_size(block));
+    if (is_last(block)) {
+        prev_block->block_size_alloc |= BLOCK_LAST;
+    }
+    if (arena->heap_last == block) {
+        arena->heap_last = prev_block;
+    }
+    return prev_block;
+}
 
-    if(block->next != NULL && (block + HEADER_SIZE + block->block_size_alloc == block->next)) {
-        assert(!is_allocated(block->next));
-        assert(block < block->next);
-        printf("coalescing next...\n");
-        printf("BLOCK 1 T_SIZE = %ld\n", block->block_size_alloc + HEADER_SIZE);
-        printf("BLOCK 2 T_SIZE = %ld\n", block->next->block_size_alloc + HEADER_SIZE);
-        printf("coalescing blocks with START/END address\n");
-        printf("&BLOCK 1 START = %p\n", (void *) block);
-        printf("&BLOCK 1 END = %p\n", (void *) block + HEADER_SIZE + block->block_size_alloc);
-        
-        block->block_size_alloc = get_size(block) + get_size(block->next) + HEADER_SIZE;
-
-        // memory_block_t *c_block = (void *) block->next;
-        printf("&BLOCK 2 START = %p\n", (void *) block->next);
-        printf("&BLOCK 2 END = %p\n", (void *) block->next + HEADER_SIZE + block->next->block_size_alloc);
-        // block->next = c_block->next;
-        block->next = block->next->next;
-        // c_block->prev = MAGIC_NUM_COALESCE;
-        // c_block->next = MAGIC_NUM_COALESCE;
-
-        printf("NEW BLOCK T_SIZE = %ld\n", block->block_size_alloc + HEADER_SIZE);
-        printf("&NEW BLOCK START = %p\n", (void *) block);
-        printf("&NEW BLOCK END = %p\n", (void *) block + HEADER_SIZE + block->block_size_alloc);
+/*
+ * coalesce_next - merges a free block with its physical successor if that
+ * block is free. The successor is taken off its free list.
+ */
+memory_block_t *coalesce_next(heap_arena_t *arena, memory_block_t *block) {
+    memory_block_t *next_block = get_phys_next(block);
+    if (!next_block || is_allocated(next_block)) {
+        //if the block was not coalesced, return the unchanged block
         return block;
     }
+
+    remove_free(arena, next_block);
+    set_size(block, get_size(block) + HEADER_SIZE + get_size(next_block));
+    if (is_last(next_block)) {
+        block->block_size_alloc |= BLOCK_LAST;
+    }
+    if (arena->heap_last == next_block) {
+        arena->heap_last = block;
+    }
     return block;
-    //if the block was not coalesced, return the unchanged block
 }
 
 /*
- * coalesce - coalesces a free memory block with neighbors.
+ * coalesce - coalesces a free memory block with its physical neighbors.
+ * The block must not be on a free list, the returned block is not on one either.
  */
-memory_block_t *coalesce(memory_block_t *block) {
+memory_block_t *coalesce(heap_arena_t *arena, memory_block_t *block) {
+    PHASE_START(start);
     assert(!is_allocated(block));
 
-    //pointer to the coalesced block if operation was successful
-    memory_block_t *prev_coalesce = coalesce_prev(block);
-    memory_block_t *result = coalesce_next(prev_coalesce);
+    memory_block_t *result = coalesce_next(arena, coalesce_prev(arena, block));
 
+    //the block after the merged one now has a new physical predecessor
+    if (!is_last(result)) {
+        get_phys_next(result)->prev_size = get_size(result);
+    }
+    PHASE_END(arena, PHASE_COALESCE, start);
     return result;
 }
 
 
 
 /*
- * uinit - Used initialize metadata required to manage the heap
- * along with allocating initial memory.
+ * get_arena - returns the arena that owns an allocated block.
  */
-int uinit() {
-
-    // printf("initializing...\n");
-    
-    
-    //call csbrk() with size PAGESIZE * 2 and add it to the free list!
-    int INITIAL_SIZE = PAGESIZE * 2;
-
-    //this block of memory is used exclusively for our header node
-    free_head = (memory_block_t *) csbrk(32);
+heap_arena_t *get_arena(memory_block_t *block) {
+    assert(block != NULL);
+    return (heap_arena_t *) block->prev;
+}
 
-    memory_block_t *init_block = (memory_block_t *) csbrk(INITIAL_SIZE);
-    //store (amount of free memory at the beginning of the list) - (header size)
-    //define that this is the only block in the free list (prev = free_head)
-    put_block(init_block, INITIAL_SIZE - HEADER_SIZE, free_head, false);
+/*
+ * reset_arena - empties an arena's free lists and fast bins and forgets
+ * its regions and threads.
+ */
+static void reset_arena(heap_arena_t *arena) {
+    pthread_mutex_init(&arena->lock, NULL);
+    for (int class = 0; class < NUM_SIZE_CLASSES; class++) {
+        arena->free_lists[class] = NULL;
+        //the index arrays are kept for reuse
+        arena->free_index[class].count = 0;
+        arena->free_index[class].broken = false;
+    }
+    for (int bin = 0; bin < NUM_FASTBINS; bin++) {
+        arena->fastbins[bin] = NULL;
+    }
+    arena->fastbin_count = 0;
+    arena->regions = NULL;
+    arena->heap_last = NULL;
+    arena->threads = 0;
+    atomic_store(&arena->remote_frees, NULL);
+    arena->next_color = 0;
+    arena->placement = placement == PLACEMENT_ADAPTIVE ? PLACEMENT_BEST_FIT : placement;
+    memset(arena->rovers, 0, sizeof(arena->rovers));
+    arena->window_finds = 0;
+    arena->window_scanned = 0;
+    memset(arena->phases, 0, sizeof(arena->phases));
+}
 
-    free_head->next = init_block;
+/*
+ * release_block - gives an allocated block back to its arena. Small blocks
+ * go on a fast bin without coalescing, everything else is merged with its
+ * free neighbors and put on its free list. Caller holds the arena's lock.
+ */
+static void release_block(heap_arena_t *arena, memory_block_t *block) {
+    block->block_size_alloc &= ~BLOCK_FAST;
+
+    if (get_size(block) <= FASTBIN_MAX) {
+        int bin = get_fastbin(get_size(block));
+        block->block_size_alloc |= BLOCK_FAST;
+        block->prev = MAGIC_NUM_COALESCE;
+        block->next = arena->fastbins[bin];
+        arena->fastbins[bin] = block;
+        if (++arena->fastbin_count >= FASTBIN_THRESHOLD) {
+            consolidate(arena);
+        }
+        return;
+    }
 
-    return 0;
+    deallocate(block);
+    block = coalesce(arena, block);
+    insert_free(arena, block);
 }
 
 /*
- * umalloc -  allocates size bytes and returns a pointer to the allocated memory.
+ * push_remote_free - hands a block to its owning arena from a thread of
+ * another arena. Pushes onto the arena's remote free stack with a single
+ * successful CAS and never waits on the arena's lock. The block stays
+ * marked allocated until the owner collects it, and its size word is left
+ * alone because only the arena (under its lock) may write it.
  */
-void *umalloc(size_t size) {
-
-    // printf("allocating a block of size\n");
-    // printf("%d\n", (int) size);
+static void push_remote_free(heap_arena_t *arena, memory_block_t *block) {
+    block->prev = MAGIC_NUM_COALESCE;
+
+    memory_block_t *head = atomic_load_explicit(&arena->remote_frees, memory_order_relaxed);
+    do {
+        block->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&arena->remote_frees, &head, block,
+                                                    memory_order_release, memory_order_relaxed));
+}
 
-    memory_block_t *found_block = find(size);
-    //points to a block of at least ALIGN(size)
+/*
+ * collect_remote_frees - takes the whole remote free stack in one exchange
+ * and releases every block into the arena. The consumer never pops single
+ * blocks, so the stack cannot suffer from ABA. Caller holds the arena's lock.
+ */
+void collect_remote_frees(heap_arena_t *arena) {
+    if (!atomic_load_explicit(&arena->remote_frees, memory_order_relaxed)) {
+        return;
+    }
 
-    if(found_block) {
+    memory_block_t *cur = atomic_exchange_explicit(&arena->remote_frees, NULL, memory_order_acquire);
+    while (cur) {
+        memory_block_t *next = cur->next;
+        release_block(arena, cur);
+        cur = next;
+    }
+}
 
-        //we will split the block here
-        //pass in an aligned size parameter, i.e. ALIGN(size)
+/*
+ * release_tcache - flushes a thread's cache back into its arena and takes
+ * the thread off the arena's load. Runs as the tcache_key destructor when
+ * a thread exits.
+ */
+static void release_tcache(void *cache) {
+    thread_cache_t *tc = cache;
+    heap_arena_t *arena = tc->arena;
+    if (!arena) {
+        return;
+    }
 
-        //do not split if ALIGN(size) = found_block->block_size_alloc + HEADER_SIZE
-        //this will create a pointer to nothing
-        // printf("splitting...\n");
-        found_block = split(found_block, ALIGN(size));
+    pthread_mutex_lock(&arena->lock);
+    collect_remote_frees(arena);
+    for (int bin = 0; bin < NUM_TCACHE_BINS; bin++) {
+        memory_block_t *cur = tc->bins[bin];
+        while (cur) {
+            memory_block_t *next = cur->next;
+            release_block(arena, cur);
+            cur = next;
+        }
+        tc->bins[bin] = NULL;
+        tc->counts[bin] = 0;
+    }
+    pthread_mutex_unlock(&arena->lock);
 
-        printf("found and allocating a block of T_SIZE :%ld\n",found_block->block_size_alloc + HEADER_SIZE);
-        //allocate the memory
-        allocate(found_block);
+    pthread_mutex_lock(&arena_lock);
+    arena->threads--;
+    pthread_mutex_unlock(&arena_lock);
+    tc->arena = NULL;
+}
 
-        //REMOVE THE BLOCK FROM THE FREE LIST
-        //asssumes best-fit algorithm
-        found_block->prev->next = found_block->next;
+/*
+ * make_tcache_key - creates the key whose destructor flushes thread caches.
+ */
+static void make_tcache_key() {
+    pthread_key_create(&tcache_key, release_tcache);
+}
 
-        //special case: block is at the end of the free list
-        if(found_block->next) {
-            found_block->next->prev = found_block->prev;
+/*
+ * attach_thread - assigns the calling thread to the arena serving the
+ * fewest threads. Runs once per thread, on its first allocation.
+ */
+static heap_arena_t *attach_thread() {
+    pthread_once(&tcache_key_once, make_tcache_key);
+
+    pthread_mutex_lock(&arena_lock);
+    heap_arena_t *arena = &arenas[0];
+    for (int i = 1; i < NUM_ARENAS; i++) {
+        if (arenas[i].threads < arena->threads) {
+            arena = &arenas[i];
         }
+    }
+    arena->threads++;
+    pthread_mutex_unlock(&arena_lock);
 
-        found_block->next = MAGIC_NUM;
-        found_block->prev = MAGIC_NUM;
+    tcache.arena = arena;
+    pthread_setspecific(tcache_key, &tcache);
+    return arena;
+}
 
-        return get_payload(found_block);
-    } else {
-        //no memory avaliable, we need to extend
-        memory_block_t *new_block = extend(size);
-        printf("no memory avaliable, creating new block of T_SIZE: %ld\n", new_block->block_size_alloc + HEADER_SIZE);
-        //NOTE: the memory from extend will never be added to the free list
-        //because it's purpose is to be allocated immediately
-        
-        allocate(new_block);
+/*
+ * thread_arena - returns the calling thread's arena, assigning one first
+ * if needed.
+ */
+static inline heap_arena_t *thread_arena() {
+    return tcache.arena ? tcache.arena : attach_thread();
+}
 
-        new_block->prev = MAGIC_NUM;
-        new_block->next = MAGIC_NUM;
+/*
+ * take_short_region - takes a region of SHORT_ARENA that is entirely free
+ * and big enough for size bytes over to arena. Short-lived objects leave
+ * whole regions behind when they die, and this way the other arenas reuse
+ * them instead of growing the heap. The region is linked below arena's
+ * newest one, so its heap_last stays put. Returns the region's block, free
+ * but NOT on a free list like extend's, or NULL. Caller holds arena's lock,
+ * which is always taken before SHORT_ARENA's.
+ */
+static memory_block_t *take_short_region(heap_arena_t *arena, size_t size) {
+    heap_arena_t *short_arena = &arenas[SHORT_ARENA];
+    if (arena == short_arena) {
+        return NULL;
+    }
 
-        
-        //DO LATER - split the new block?
-        //we would have to add the part that we don't use to the free list
+    pthread_mutex_lock(&short_arena->lock);
+    collect_remote_frees(short_arena);
+    if (short_arena->fastbin_count) {
+        consolidate(short_arena);
+    }
+    heap_region_t **link = &short_arena->regions;
+    memory_block_t *block = NULL;
+    for (heap_region_t *region = *link; region; link = &region->next, region = *link) {
+        memory_block_t *first = get_region_first(region);
+        if (!is_allocated(first) && is_last(first) && get_size(first) >= size) {
+            block = first;
+            break;
+        }
+    }
+    if (!block) {
+        pthread_mutex_unlock(&short_arena->lock);
+        return NULL;
+    }
 
-        return get_payload(new_block);
+    heap_region_t *region = *link;
+    remove_free(short_arena, block);
+    *link = region->next;
+    if (short_arena->heap_last == block) {
+        short_arena->heap_last = short_arena->regions ? get_region_last(short_arena->regions) : NULL;
     }
+    pthread_mutex_unlock(&short_arena->lock);
 
+    if (arena->regions) {
+        region->next = arena->regions->next;
+        arena->regions->next = region;
+    } else {
+        region->next = NULL;
+        arena->regions = region;
+        arena->heap_last = block;
+    }
+    return block;
 }
 
 /*
- * ufree -  frees the memory space pointed to by ptr, which must have been called
- * by a previous call to malloc.
+ * arena_malloc - the locked slow path of umalloc. Collects blocks freed by
+ * other threads, then tries the arena's fast bin, then its free lists, then
+ * a free region left by short-lived objects, then grows the arena. Without
+ * grow it stops after the free lists. Returns the allocated block or NULL.
+ * Caller holds the arena's lock.
  */
-void ufree(void *ptr) {
-
-    // printf("free");
-    memory_block_t *block = get_block(ptr);
-    //if the user tries to free an unallocated block, do nothing
-    //we know that the block is unallocated because it will not have a magic number (if not using alloc list)
-    assert(is_allocated(block));
-
-    // if (is_allocated(block)) {
-    //     printf("allocated");
-    // }
-    // if ((block->next) == MAGIC_NUM) {
-    //     printf("true.");
-    // }
-    // printf("(&(block->next) == MAGIC_NUM));
-    if( is_allocated(block) && (block->next == MAGIC_NUM) ) {
-        printf("Hello.");
-        
-        //we need to convert this block into a free block
-        deallocate(block);
-
-        //if the free list is empty, we can simply set free_head->next to the block
-        if (!free_head->next) {
-            printf("free list empty\n");
-            free_head->next = block;
-            block->prev = free_head;
-            block->next = NULL;
-            // coalesce(block);
-            assert(block->prev != MAGIC_NUM);
-            assert(block->next != MAGIC_NUM);
-            return;
+static memory_block_t *arena_malloc(heap_arena_t *arena, size_t aligned, bool grow) {
+    collect_remote_frees(arena);
+
+    //small sizes are served straight from their fast bin when possible
+    if (aligned <= FASTBIN_MAX) {
+        int bin = get_fastbin(aligned);
+        memory_block_t *fast_block = arena->fastbins[bin];
+        if (fast_block) {
+            arena->fastbins[bin] = fast_block->next;
+            arena->fastbin_count--;
+            fast_block->block_size_alloc &= ~BLOCK_FAST;
+            return fast_block;
         }
+    }
 
-
-        //figure out where to insert this block into the free list
-        memory_block_t *prev_free_block = NULL;
-        memory_block_t *current_free_block = free_head->next;
-
-        while (current_free_block) {
-            // if (&block < &current_free_block) {
-            if (block < current_free_block) {
-                //this is the place where our block should go
-
-                //check if this block will be at the beginning of the free list
-                if (!prev_free_block) {
-                    printf("hello");
-                    block->prev = free_head;
-                    block->next = free_head->next;
-                    free_head->next = block;
-                    // coalesce(block);
-                    assert(block->prev != MAGIC_NUM);
-                    assert(block->next != MAGIC_NUM);
-                    return;
-                } else {
-                    //splice!
-                    printf("splicing...");
-                    prev_free_block->next = block;
-                    block->prev = prev_free_block;
-                    block->next = current_free_block;
-                    // coalesce(block);
-                    assert(block->prev != MAGIC_NUM);
-                    assert(block->next != MAGIC_NUM);
-                    return;
-                }
-                
-            } else {
-                printf("continuing...\n");
-                //keep going through the free list
-                prev_free_block = current_free_block;
-                current_free_block = current_free_block->next;
-            }
+    memory_block_t *found_block = find(arena, aligned);
+    if (!found_block && arena->fastbin_count) {
+        //the fast bins may hold enough memory once merged
+        consolidate(arena);
+        found_block = find(arena, aligned);
+    }
+    if (found_block) {
+        remove_free(arena, found_block);
+    } else if (!grow) {
+        return NULL;
+    } else if (!(found_block = take_short_region(arena, aligned))) {
+        //no memory avaliable, we need to extend
+        found_block = extend(arena, aligned);
+        if (!found_block) {
+            return NULL;
         }
+    }
 
-        //we have reached the end of the list
-        //append the free block to the end of the list
-        prev_free_block->next = block;
-        block->prev = prev_free_block;
-        block->next = NULL;
-        // coalesce(block);`
-        assert(block->prev != MAGIC_NUM);
-        assert(block->next != MAGIC_NUM);
+    found_block = split(arena, found_block, aligned);
+    allocate(found_block);
+    return found_block;
+}
+
+/*
+ * adopt_block - points a live block of a reattached heap at its new arena.
+ * Anything else was free or on its way to being freed when the heap was last
+ * used, sitting on a free list, a fast bin, a thread cache or a remote free
+ * stack. Returns true for live blocks.
+ */
+static bool adopt_block(heap_arena_t *arena, memory_block_t *block) {
+    block->block_size_alloc &= ~BLOCK_FAST;
+    if (is_allocated(block) && (block->next == MAGIC_NUM || block->next == MAGIC_NUM_SAMPLED ||
+                                block->next == MAGIC_NUM_TRACKED)) {
+        //the profiler and predictor start out empty, so nothing is followed any more
+        block->next = MAGIC_NUM;
+        block->prev = (memory_block_t *) arena;
+        return true;
+    }
+    deallocate(block);
+    return false;
+}
+
+/*
+ * adopt_region - rebuilds a region of a reattached heap block by block,
+ * merging every run of blocks that aren't live into one free block. Returns
+ * the region's last block, or NULL if a block runs past the region.
+ */
+static memory_block_t *adopt_region(heap_arena_t *arena, heap_region_t *region) {
+    memory_block_t *block = get_region_first(region);
+    memory_block_t *run = NULL; //free block the walk is merging into
+    size_t prev_size = 0;
+
+    while (true) {
+        if ((void *) get_payload(block) + get_size(block) > region->end) {
+            return NULL;
+        }
+        bool last = is_last(block);
+        memory_block_t *next_block = get_phys_next(block);
+
+        if (adopt_block(arena, block)) {
+            if (run) {
+                insert_free(arena, run);
+                prev_size = get_size(run);
+                run = NULL;
+            }
+            block->prev_size = prev_size;
+            prev_size = get_size(block);
+        } else if (run) {
+            set_size(run, get_size(run) + HEADER_SIZE + get_size(block));
+            run->block_size_alloc |= block->block_size_alloc & BLOCK_LAST;
+        } else {
+            run = block;
+            run->prev_size = prev_size;
+        }
+
+        if (last) {
+            break;
+        }
+        block = next_block;
+    }
+    if (run) {
+        insert_free(arena, run);
+        return run;
+    }
+    return block;
+}
+
+/*
+ * attach_heap - hands every region of a reattached persistent heap to arena.
+ * The file only keeps the regions and their boundary tags, so the regions
+ * are walked in address order and the free lists and fast bins are built
+ * again from scratch. Region links are shifted when the file was mapped at a
+ * new base. Runs check_heap when the program has one. Returns 0, or -1 if
+ * the heap is inconsistent.
+ */
+static int attach_heap(heap_arena_t *arena) {
+    char *base = (char *) persist;
+    intptr_t delta = base - (char *) persist->base;
+    char *top = base + persist->top;
+
+    for (char *mem = base + PAGESIZE; mem < top; ) {
+        heap_region_t *region = (heap_region_t *) mem;
+        region->end = (char *) region->end + delta;
+        if ((char *) region->end <= mem || (char *) region->end > top) {
+            return -1;
+        }
+        region->next = arena->regions;
+        arena->regions = region;
+        if (!(arena->heap_last = adopt_region(arena, region))) {
+            return -1;
+        }
+        mem = region->end;
+    }
+    persist->base = (uintptr_t) base;
+
+    if (check_heap && check_heap() != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+#ifdef UMALLOC_PHASES
+static void report_phases_at_exit() {
+    umalloc_phase_report(stderr);
+}
+#endif
+
+/*
+ * uinit - Used initialize metadata required to manage the heap
+ * along with allocating initial memory. Must run before any thread
+ * allocates, it resets every arena and the calling thread's cache.
+ */
+int uinit() {
+    char *placement_env = getenv("UMALLOC_PLACEMENT");
+    for (placement_t mode = 0; placement_env && mode < NUM_PLACEMENTS; mode++) {
+        if (!strcmp(placement_env, placement_name(mode))) {
+            placement = mode;
+        }
+    }
+    for (int i = 0; i < NUM_HEAPS; i++) {
+        reset_arena(&arenas[i]);
+    }
+    for (int bin = 0; bin < NUM_TCACHE_BINS; bin++) {
+        tcache.bins[bin] = NULL;
+        tcache.counts[bin] = 0;
+    }
+    tcache.arena = NULL;
+    tcache.until_sample = 0;
+    tcache.until_track = 0;
+    alloc_head = NULL;
+    heapprof_init_from_env();
+    heapprof_reset_live();
+    uhandle_reset();
+    lifetime_reset();
+    short_bytes = 0;
+
+    char *search = getenv("UMALLOC_FREE_SEARCH");
+    for (free_search_t mode = FREE_SEARCH_AUTO; search && mode <= FREE_SEARCH_AVX2; mode++) {
+        if (!strcmp(search, free_search_name(mode))) {
+            free_search = mode;
+        }
+    }
+    free_search = resolve_free_search(free_search);
+
+    char *colors = getenv("UMALLOC_COLORS");
+    if (colors && *colors) {
+        num_colors = atoi(colors);
+    }
+
+    char *lifetime = getenv("UMALLOC_LIFETIME");
+    if (lifetime && *lifetime) {
+        predict_lifetimes = *lifetime != '0';
+    }
+
+    char *hugepages = getenv("UMALLOC_HUGEPAGES");
+    morecore = use_hugepages || (hugepages && *hugepages && *hugepages != '0') ? chuge : csbrk;
+
+#ifdef UMALLOC_PHASES
+    //UMALLOC_PHASE_REPORT=1 prints the phase breakdown to stderr at exit
+    static bool report_registered = false;
+    char *report = getenv("UMALLOC_PHASE_REPORT");
+    if (!report_registered && report && *report && *report != '0') {
+        atexit(report_phases_at_exit);
+        report_registered = true;
+    }
+#endif
+
+    char *persist_env = getenv("UMALLOC_PERSIST");
+    if (!persist_path && persist_env && *persist_env) {
+        umalloc_persist(persist_env, PERSIST_DEFAULT_CAPACITY);
+    }
+    if (persist_path) {
+        //a heap left mapped by an earlier uinit is dropped
+        cpersist_close();
+        if (!(persist = cpersist_open(persist_path, persist_capacity))) {
+            return -1;
+        }
+        morecore = cpersist;
+        if (persist->top > PAGESIZE) {
+            return attach_heap(&arenas[0]);
+        }
+    }
+
+    //the initial block seeds the main arena
+    heap_arena_t *arena = &arenas[0];
+
+    //call csbrk() with size PAGESIZE * 2 and add it to the free list!
+    int INITIAL_SIZE = PAGESIZE * 2;
+
+    pthread_mutex_lock(&sbrk_lock);
+    heap_region_t *region = morecore(INITIAL_SIZE);
+    pthread_mutex_unlock(&sbrk_lock);
+    if (region == NULL || region == (void *) -1) {
+        return -1;
+    }
+    region->next = NULL;
+    region->end = (void *) region + INITIAL_SIZE;
+    arena->regions = region;
+
+    memory_block_t *init_block = get_region_first(region);
+    put_block(init_block, INITIAL_SIZE - REGION_HEADER_SIZE - HEADER_SIZE, NULL, false);
+    init_block->prev_size = 0;
+    init_block->block_size_alloc |= BLOCK_FIRST | BLOCK_LAST;
+    insert_free(arena, init_block);
+
+    arena->heap_last = init_block;
+    return 0;
+}
+
+/*
+ * umalloc_use_hugepages - opts the heap into transparent huge pages from the
+ * next uinit on. The heap then grows through 2 MB aligned, MADV_HUGEPAGE
+ * reservations instead of the program break, so small-object slabs end up
+ * packed into a few huge pages and need far fewer TLB entries. Setting
+ * UMALLOC_HUGEPAGES=1 in the environment does the same.
+ */
+void umalloc_use_hugepages(bool enable) {
+    use_hugepages = enable;
+}
+
+/*
+ * umalloc_persist - keeps the heap in the file at path from the next uinit
+ * on, so a restarted process can attach to everything it allocated. A new
+ * file is created sparse with capacity bytes, an existing one is reattached
+ * at the address it was mapped at before when that is free. Objects that
+ * point at each other should hold offsets from upersist_base if the heap may
+ * have to move. Setting UMALLOC_PERSIST=path in the environment does the same
+ * with PERSIST_DEFAULT_CAPACITY. A NULL path goes back to an anonymous heap.
+ */
+void umalloc_persist(const char *path, size_t capacity) {
+    persist_path = path;
+    persist_capacity = capacity;
+}
+
+/*
+ * upersist_set_root - records the object a restarted process starts from.
+ */
+void upersist_set_root(void *ptr) {
+    assert(persist);
+    persist->root = ptr ? (char *) ptr - (char *) persist : 0;
+}
+
+/*
+ * upersist_get_root - the object recorded by upersist_set_root, NULL if none.
+ */
+void *upersist_get_root() {
+    return persist && persist->root ? (char *) persist + persist->root : NULL;
+}
+
+/*
+ * upersist_base - where the persistent heap is mapped, NULL if there is none.
+ */
+void *upersist_base() {
+    return persist;
+}
+
+/*
+ * upersist_close - writes the persistent heap back to its file and unmaps
+ * it. Blocks still cached by threads are found again at the next attach.
+ * Nothing may be allocated or freed until the next uinit.
+ */
+int upersist_close() {
+    persist = NULL;
+    persist_path = NULL;
+    morecore = csbrk;
+    return cpersist_close();
+}
+
+/*
+ * umalloc_phase_report - prints how often each slow path phase ran and how
+ * long it took, summed over the arenas since uinit. Phases nest, so their
+ * times overlap, see phase_t.
+ */
+void umalloc_phase_report(FILE *out) {
+#ifdef UMALLOC_PHASES
+    static const char *names[NUM_PHASES] = {"find", "split", "extend", "morecore", "coalesce", "insert_free"};
+    static const char *items[NUM_PHASES] = {"scanned", "", "", "bytes", "", ""};
+
+    fprintf(out, "%-12s %12s %16s %12s %12s\n", "phase", "calls", PHASE_TICKS, "per call", "items/call");
+    for (int phase = 0; phase < NUM_PHASES; phase++) {
+        phase_stats_t total = {0};
+        for (int i = 0; i < NUM_HEAPS; i++) {
+            total.calls += arenas[i].phases[phase].calls;
+            total.ticks += arenas[i].phases[phase].ticks;
+            total.items += arenas[i].phases[phase].items;
+        }
+        uint64_t calls = total.calls ? total.calls : 1;
+        fprintf(out, "%-12s %12lu %16lu %12.1f", names[phase], total.calls, total.ticks,
+                (double) total.ticks / calls);
+        if (*items[phase]) {
+            fprintf(out, " %12.1f %s", (double) total.items / calls, items[phase]);
+        }
+        fprintf(out, "\n");
+    }
+#else
+    fprintf(out, "Phase timers are compiled out, rebuild with make PHASES=1.\n");
+#endif
+}
+
+/*
+ * umalloc_set_colors - how many cache line offsets new small-object slabs
+ * rotate through from the next uinit on, 0 or 1 turns coloring off.
+ * Setting UMALLOC_COLORS=n in the environment does the same.
+ */
+void umalloc_set_colors(unsigned colors) {
+    num_colors = colors;
+}
+
+/*
+ * umalloc_set_placement - picks the placement policy of every arena from
+ * the next uinit on. PLACEMENT_ADAPTIVE starts each arena on best fit and
+ * reconsiders every PLACEMENT_WINDOW finds, see adapt_placement.
+ * UMALLOC_PLACEMENT=best|good|first|next|adaptive overrides it from the
+ * environment.
+ */
+void umalloc_set_placement(placement_t policy) {
+    placement = policy;
+}
+
+/*
+ * umalloc_placement - the policy the calling thread's arena places requests
+ * with right now, which PLACEMENT_ADAPTIVE changes as it goes.
+ */
+placement_t umalloc_placement() {
+    heap_arena_t *arena = tcache.arena ? tcache.arena : &arenas[0];
+    return arena->placement;
+}
+
+const char *placement_name(placement_t policy) {
+    static const char *names[] = {"best", "good", "first", "next", "adaptive"};
+    return names[policy];
+}
+
+/*
+ * umalloc_set_free_search - picks how find searches a size class, from the
+ * next uinit on. FREE_SEARCH_AUTO takes the widest SIMD search the CPU has,
+ * FREE_SEARCH_LIST is the pointer chasing walk the index replaced.
+ * UMALLOC_FREE_SEARCH=list|scalar|sse2|avx2 overrides it from the environment.
+ */
+void umalloc_set_free_search(free_search_t search) {
+    free_search = search;
+}
+
+/*
+ * sample_block - hands a block to the heap profiler once the thread's sample
+ * countdown runs out, and starts the next countdown.
+ */
+static void sample_block(memory_block_t *block, size_t size, void *caller) {
+    if (heapprof_record(get_payload(block), size, caller)) {
+        block->next = MAGIC_NUM_SAMPLED;
+    }
+    tcache.until_sample = heapprof_next_sample();
+}
+
+/*
+ * thread_malloc - allocates size bytes from the thread's cache or arena.
+ * Small sizes are popped off the thread's cache without taking a lock,
+ * everything else goes through the thread's arena. caller is the call site
+ * heapprof records.
+ */
+static void *thread_malloc(size_t size, void *caller) {
+    size_t aligned = ALIGN(size);
+    heap_arena_t *arena = thread_arena();
+    memory_block_t *found_block = NULL;
+
+    if (aligned <= TCACHE_MAX) {
+        int bin = get_fastbin(aligned);
+        found_block = tcache.bins[bin];
+        if (found_block) {
+            tcache.bins[bin] = found_block->next;
+            tcache.counts[bin]--;
+        }
+    }
+
+    if (!found_block) {
+        pthread_mutex_lock(&arena->lock);
+        found_block = arena_malloc(arena, aligned, true);
+        pthread_mutex_unlock(&arena->lock);
+        if (!found_block) {
+            return NULL;
+        }
+    }
+
+    found_block->next = MAGIC_NUM;
+    found_block->prev = (memory_block_t *) arena;
+
+    //the profiler costs a single decrement until the countdown runs out
+    if ((tcache.until_sample -= aligned) < 0) {
+        sample_block(found_block, size, caller);
+    }
+    return get_payload(found_block);
+}
+
+/*
+ * short_malloc - allocates size bytes for a short-lived object. Until
+ * SHORT_ARENA_MIN short-lived bytes have been asked for, it is a plain
+ * allocation. After that a free block the calling thread's arena already
+ * has is used first, the object is gone before it can pin anything there.
+ * Only an object that would grow that arena goes to SHORT_ARENA, so the
+ * short-lived objects that need new memory share regions of their own. The
+ * thread cache is skipped, it would hand a SHORT_ARENA block to the
+ * thread's own arena once freed.
+ */
+static void *short_malloc(size_t size, void *caller) {
+    size_t aligned = ALIGN(size);
+    if (atomic_fetch_add_explicit(&short_bytes, aligned, memory_order_relaxed) < SHORT_ARENA_MIN) {
+        return thread_malloc(size, caller);
+    }
+    heap_arena_t *arena = thread_arena();
+    pthread_mutex_lock(&arena->lock);
+    memory_block_t *found_block = arena_malloc(arena, aligned, false);
+    pthread_mutex_unlock(&arena->lock);
+    if (!found_block) {
+        arena = &arenas[SHORT_ARENA];
+        pthread_mutex_lock(&arena->lock);
+        found_block = arena_malloc(arena, aligned, true);
+        pthread_mutex_unlock(&arena->lock);
+    }
+    if (!found_block) {
+        return NULL;
+    }
+
+    found_block->next = MAGIC_NUM;
+    found_block->prev = (memory_block_t *) arena;
+    if ((tcache.until_sample -= aligned) < 0) {
+        sample_block(found_block, size, caller);
+    }
+    return get_payload(found_block);
+}
+
+/*
+ * hinted_malloc - allocates size bytes by their expected lifetime. Unknown
+ * lifetimes are predicted from caller when prediction is on, and one such
+ * allocation in LIFETIME_SAMPLE is followed to teach the predictor.
+ */
+static void *hinted_malloc(size_t size, lifetime_t lifetime, void *caller) {
+    if (size == 0) {
+        size = 1;
+    }
+    bool predicted = lifetime == LIFETIME_UNKNOWN && predict_lifetimes;
+    int class = get_size_class(ALIGN(size));
+    if (predicted) {
+        lifetime = lifetime_predict(caller, class);
+    }
+
+    void *ptr = lifetime == LIFETIME_SHORT ? short_malloc(size, caller) : thread_malloc(size, caller);
+    if (ptr && predicted && --tcache.until_track < 0) {
+        tcache.until_track = LIFETIME_SAMPLE - 1;
+        //a block heapprof samples is left to it
+        memory_block_t *block = get_block(ptr);
+        if (block->next == MAGIC_NUM && lifetime_track(ptr, caller, class)) {
+            block->next = MAGIC_NUM_TRACKED;
+        }
+    }
+    return ptr;
+}
+
+/*
+ * umalloc -  allocates size bytes and returns a pointer to the allocated memory,
+ * or NULL past MAX_REQUEST. With lifetime prediction on, objects expected to
+ * die young are kept apart in SHORT_ARENA.
+ */
+void *umalloc(size_t size) {
+    //past this ALIGN wraps, and the fast paths below trust the aligned size
+    if (size > MAX_REQUEST) {
+        return NULL;
+    }
+    if (predict_lifetimes) {
+        return hinted_malloc(size, LIFETIME_UNKNOWN, __builtin_return_address(0));
+    }
+    return thread_malloc(size ? size : 1, __builtin_return_address(0));
+}
+
+/*
+ * umalloc_hint - allocates size bytes for an object the caller expects to
+ * live as long as lifetime says. LIFETIME_SHORT objects go to SHORT_ARENA,
+ * whose regions are handed to the other arenas once they are empty again,
+ * so short-lived objects never pin a region long-lived ones are spread over.
+ * LIFETIME_UNKNOWN is the same as umalloc.
+ */
+void *umalloc_hint(size_t size, lifetime_t lifetime) {
+    if (size > MAX_REQUEST) {
+        return NULL;
+    }
+    return hinted_malloc(size, lifetime, __builtin_return_address(0));
+}
+
+/*
+ * umalloc_predict_lifetimes - routes plain umalloc calls by a lifetime the
+ * predictor learns per call site and size class, from the next uinit on.
+ * Setting UMALLOC_LIFETIME=1 in the environment does the same.
+ */
+void umalloc_predict_lifetimes(bool enable) {
+    predict_lifetimes = enable;
+}
+
+/*
+ * ufree -  frees the memory space pointed to by ptr, which must have been called
+ * by a previous call to malloc.
+ * Small blocks from the thread's own arena are pushed on the thread's cache
+ * without taking a lock, other blocks of the thread's arena are released
+ * under its lock, and blocks owned by another arena are pushed on that
+ * arena's remote free stack.
+ */
+void ufree(void *ptr) {
+    if (ptr == NULL) {
         return;
+    }
+
+    memory_block_t *block = get_block(ptr);
+    //we know that the block is allocated because it has the magic number
+    assert(block->next == MAGIC_NUM || block->next == MAGIC_NUM_SAMPLED ||
+           block->next == MAGIC_NUM_TRACKED);
+    if (block->next != MAGIC_NUM) {
+        if (block->next == MAGIC_NUM_SAMPLED) {
+            heapprof_forget(ptr);
+        } else if (block->next == MAGIC_NUM_TRACKED) {
+            lifetime_forget(ptr, true);
+        } else {
+            return;
+        }
+        block->next = MAGIC_NUM;
+    }
+
+    heap_arena_t *arena = get_arena(block);
+    if (arena != tcache.arena) {
+        push_remote_free(arena, block);
+        return;
+    }
+
+    assert(is_allocated(block));
+    if (get_size(block) <= TCACHE_MAX) {
+        int bin = get_fastbin(get_size(block));
+        if (tcache.counts[bin] < TCACHE_FILL) {
+            block->prev = MAGIC_NUM_COALESCE;
+            block->next = tcache.bins[bin];
+            tcache.bins[bin] = block;
+            tcache.counts[bin]++;
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&arena->lock);
+    release_block(arena, block);
+    pthread_mutex_unlock(&arena->lock);
+}
+
+/*
+ * resize_in_place - resizes an allocated block to aligned bytes within its
+ * free neighbors. Growing takes over a free successor, and a free predecessor
+ * if that is still not enough, sliding the contents down into it. Shrinking
+ * splits the tail off and merges it with whatever is free after it. Returns
+ * the resized block, which is marked allocated for the arena, or NULL if the
+ * neighbors are too small. Caller holds the arena's lock.
+ */
+static memory_block_t *resize_in_place(heap_arena_t *arena, memory_block_t *block, size_t aligned) {
+    size_t size = get_size(block);
+    if (aligned > size) {
+        memory_block_t *next_block = get_phys_next(block);
+        memory_block_t *prev_block = get_phys_prev(block);
+        bool next_free = next_block && !is_allocated(next_block);
+        bool prev_free = prev_block && !is_allocated(prev_block);
+        size_t room = size + (next_free ? HEADER_SIZE + get_size(next_block) : 0);
+        if (room < aligned) {
+            if (!prev_free || room + HEADER_SIZE + get_size(prev_block) < aligned) {
+                return NULL;
+            }
+        } else {
+            prev_free = false;
+        }
+
+        //merge the chosen neighbors exactly the way coalesce would
+        deallocate(block);
+        if (next_free) {
+            block = coalesce_next(arena, block);
+        }
+        if (prev_free) {
+            memory_block_t *merged = coalesce_prev(arena, block);
+            memmove(get_payload(merged), get_payload(block), size);
+            block = merged;
+        }
+        if (!is_last(block)) {
+            get_phys_next(block)->prev_size = get_size(block);
+        }
+        allocate(block);
+        block->next = MAGIC_NUM;
+        block->prev = (memory_block_t *) arena;
+    }
+
+    size = get_size(block);
+    split(arena, block, aligned);
+    if (get_size(block) < size) {
+        //split put the tail on a free list without looking at its neighbor
+        memory_block_t *tail = get_phys_next(block);
+        remove_free(arena, tail);
+        insert_free(arena, coalesce(arena, tail));
+    }
+    return block;
+}
+
+/*
+ * urealloc - changes the size of the block at ptr to size bytes, keeping its
+ * contents up to the smaller of the two sizes. The block is resized within
+ * its free neighbors when it can be, otherwise the contents move to a new
+ * block and the old one is freed. urealloc(NULL, size) is umalloc(size), urealloc(ptr, 0) frees ptr
+ * and returns NULL. On failure ptr is left untouched and NULL is returned.
+ */
+void *urealloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return umalloc(size);
+    }
+    if (size == 0) {
+        ufree(ptr);
+        return NULL;
+    }
+    //leaves room for the headroom below as well as the alignment
+    if (size > MAX_REQUEST) {
+        return NULL;
+    }
+
+    memory_block_t *block = get_block(ptr);
+    assert(block->next == MAGIC_NUM || block->next == MAGIC_NUM_SAMPLED ||
+           block->next == MAGIC_NUM_TRACKED);
+    size_t aligned = ALIGN(size);
+    if (block->next == MAGIC_NUM_TRACKED) {
+        //a resized object is no longer the one its site allocated
+        lifetime_forget(ptr, false);
+        block->next = MAGIC_NUM;
+    }
+
+    //sampled blocks always move, so the profiler sees the new size
+    if (block->next == MAGIC_NUM) {
+        //the owning arena's lock guards the size word, even from another thread
+        heap_arena_t *arena = get_arena(block);
+        pthread_mutex_lock(&arena->lock);
+        memory_block_t *resized = resize_in_place(arena, block, aligned);
+        pthread_mutex_unlock(&arena->lock);
+        if (resized) {
+            return get_payload(resized);
+        }
+    }
+
+    //a block that had to move to grow is likely to grow again, the headroom
+    //keeps a steadily growing buffer from moving on every call
+    size_t old_size = get_size(block);
+    void *moved = NULL;
+    if (aligned > old_size) {
+        moved = umalloc(size + size / REALLOC_HEADROOM);
+    }
+    if (!moved && !(moved = umalloc(size))) {
+        return NULL;
+    }
+    memcpy(moved, ptr, old_size < size ? old_size : size);
+    ufree(ptr);
+    return moved;
+}
+
+/*
+ * slide_down - moves an allocated block's contents down into its free
+ * physical predecessor. The block ends up where the predecessor started and
+ * the free space moves above it, merged with whatever is free there. Returns
+ * the moved block, or NULL if the predecessor is not free. Only a block no
+ * one holds a pointer into may be moved. Caller holds the arena's lock.
+ */
+memory_block_t *slide_down(heap_arena_t *arena, memory_block_t *block) {
+    memory_block_t *prev_block = get_phys_prev(block);
+    if (!prev_block || is_allocated(prev_block)) {
+        return NULL;
+    }
+
+    size_t size = get_size(block);
+    deallocate(block);
+    memory_block_t *moved = coalesce_prev(arena, block);
+    memmove(get_payload(moved), get_payload(block), size);
+    allocate(moved);
+    moved->next = MAGIC_NUM;
+    moved->prev = (memory_block_t *) arena;
+
+    //the old predecessor always leaves room for a free block behind
+    split(arena, moved, size);
+    memory_block_t *tail = get_phys_next(moved);
+    remove_free(arena, tail);
+    insert_free(arena, coalesce(arena, tail));
+    return moved;
+}
+
+/*
+ * move_lower - moves an allocated block's contents into the lowest free
+ * block below it that fits. Older regions are lower on the break, so this
+ * empties the newest regions out. Looks at no more than limit free blocks,
+ * settling for the lowest of those, and adds the number looked at to
+ * scanned. Returns the moved block or NULL. The same rules as slide_down
+ * apply.
+ */
+memory_block_t *move_lower(heap_arena_t *arena, memory_block_t *block, size_t limit, size_t *scanned) {
+    size_t size = get_size(block);
+    memory_block_t *target = NULL;
+    size_t looked = 0;
+    for (int class = get_size_class(size); class < NUM_SIZE_CLASSES && looked < limit; class++) {
+        for (memory_block_t *cur = arena->free_lists[class]; cur && looked < limit; cur = cur->next) {
+            looked++;
+            if (cur < block && (!target || cur < target) && get_size(cur) >= size) {
+                target = cur;
+            }
+        }
+    }
+    *scanned += looked;
+    if (!target) {
+        return NULL;
+    }
+
+    remove_free(arena, target);
+    target = split(arena, target, size);
+    allocate(target);
+    target->next = MAGIC_NUM;
+    target->prev = (memory_block_t *) arena;
+    memcpy(get_payload(target), get_payload(block), size);
+
+    deallocate(block);
+    insert_free(arena, coalesce(arena, block));
+    return target;
+}
+
+/*
+ * trim_heap - gives free memory at the top of the program break back to the
+ * system. Newest regions that are entirely free are released whole, then
+ * the whole pages of a free block ending the region below them. Only a heap
+ * on the break can shrink, and only while nothing else has moved the break
+ * past the arena's newest region. Returns the bytes released. Caller holds
+ * the arena's lock.
+ */
+size_t trim_heap(heap_arena_t *arena) {
+    if (morecore != csbrk) {
+        return 0;
+    }
+
+    size_t released = 0;
+    memory_block_t *last;
+    pthread_mutex_lock(&sbrk_lock);
+    while ((last = arena->heap_last) && !is_allocated(last) && sbrk(0) == arena->regions->end) {
+        heap_region_t *region = arena->regions;
+        //the block lives in the memory given back, so it leaves its list first
+        remove_free(arena, last);
+        if (is_first(last) && region->next) {
+            intptr_t size = (char *) region->end - (char *) region;
+            heap_region_t *below = region->next;
+            if (morecore(-size) == (void *) -1) {
+                insert_free(arena, last);
+                break;
+            }
+            arena->regions = below;
+            arena->heap_last = get_region_last(arena->regions);
+            released += size;
+            continue;
+        }
+
+        size_t release = (get_size(last) - MIN_PAYLOAD) & ~(size_t) (PAGESIZE - 1);
+        if (release && morecore(-(intptr_t) release) != (void *) -1) {
+            region->end -= release;
+            set_size(last, get_size(last) - release);
+            released += release;
+        }
+        insert_free(arena, last);
+        break;
+    }
+    pthread_mutex_unlock(&sbrk_lock);
+    return released;
+}
+
+/*
+ * aligned_payload - returns where an alignment-aligned payload could start
+ * inside a free block. If the block's own payload is not aligned, the
+ * payload is pushed far enough that the skipped bytes can form a free block
+ * of their own.
+ */
+static uintptr_t aligned_payload(memory_block_t *block, size_t alignment) {
+    uintptr_t payload = (uintptr_t) get_payload(block);
+    if (payload % alignment == 0) {
+        return payload;
+    }
+    uintptr_t min_payload = payload + HEADER_SIZE + MIN_PAYLOAD;
+    return (min_payload + alignment - 1) & ~(uintptr_t)(alignment - 1);
+}
+
+/*
+ * fits_aligned - returns true if an aligned payload of size bytes fits in
+ * the free block.
+ */
+static bool fits_aligned(memory_block_t *block, size_t size, size_t alignment) {
+    uintptr_t end = (uintptr_t) get_payload(block) + get_size(block);
+    return aligned_payload(block, alignment) + size <= end;
+}
+
+/*
+ * find_aligned - first fit search for a free block that can hold an aligned
+ * payload of size bytes. Smaller classes can never fit, so the search starts
+ * at the request's own class.
+ */
+static memory_block_t *find_aligned(heap_arena_t *arena, size_t size, size_t alignment) {
+    for (int class = get_size_class(size); class < NUM_SIZE_CLASSES; class++) {
+        for (memory_block_t *cur = arena->free_lists[class]; cur; cur = cur->next) {
+            if (fits_aligned(cur, size, alignment)) {
+                return cur;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * carve_aligned - splits the leading fragment off a free block (that is not
+ * on a free list) so the block that remains has an aligned payload. The
+ * fragment goes back on its free list.
+ */
+static memory_block_t *carve_aligned(heap_arena_t *arena, memory_block_t *block, size_t alignment) {
+    uintptr_t payload = aligned_payload(block, alignment);
+    if (payload == (uintptr_t) get_payload(block)) {
+        return block;
+    }
+
+    memory_block_t *a_block = get_block((void *) payload);
+    size_t lead_size = (void *) a_block - get_payload(block);
+    size_t a_size = get_size(block) - lead_size - HEADER_SIZE;
+
+    put_block(a_block, a_size, NULL, false);
+    a_block->prev_size = lead_size;
+    if (is_last(block)) {
+        a_block->block_size_alloc |= BLOCK_LAST;
+        block->block_size_alloc &= ~BLOCK_LAST;
+        if (arena->heap_last == block) {
+            arena->heap_last = a_block;
+        }
+    } else {
+        get_phys_next(a_block)->prev_size = a_size;
+    }
+    set_size(block, lead_size);
+
+    insert_free(arena, block);
+    return a_block;
+}
+
+/*
+ * umemalign - allocates size bytes whose address is a multiple of alignment,
+ * which must be a power of two. The block is carved straight out of a free
+ * block so no bytes are wasted in front of the payload, and it is released
+ * with a plain ufree.
+ */
+void *umemalign(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+    if (alignment <= ALIGNMENT) {
+        return umalloc(size);
+    }
+    //this path skips umalloc's check, and with alignment at most half of
+    //SIZE_MAX a size up to MAX_REQUEST can't wrap the extend below
+    if (size > MAX_REQUEST) {
+        return NULL;
+    }
+    if (size == 0) {
+        size = 1;
+    }
+    size_t aligned = ALIGN(size);
+
+    heap_arena_t *arena = thread_arena();
+    pthread_mutex_lock(&arena->lock);
+    collect_remote_frees(arena);
+
+    memory_block_t *found_block = find_aligned(arena, aligned, alignment);
+    if (!found_block && arena->fastbin_count) {
+        consolidate(arena);
+        found_block = find_aligned(arena, aligned, alignment);
+    }
+    if (found_block) {
+        remove_free(arena, found_block);
+    } else {
+        //worst case the payload lands alignment - ALIGNMENT bytes past a
+        //leading free fragment
+        found_block = extend(arena, aligned + alignment + HEADER_SIZE + MIN_PAYLOAD);
+        if (!found_block) {
+            pthread_mutex_unlock(&arena->lock);
+            return NULL;
+        }
+    }
+
+    found_block = carve_aligned(arena, found_block, alignment);
+    assert(get_size(found_block) >= aligned);
+    found_block = split(arena, found_block, aligned);
+    allocate(found_block);
+    pthread_mutex_unlock(&arena->lock);
+
+    found_block->next = MAGIC_NUM;
+    found_block->prev = (memory_block_t *) arena;
 
+    if ((tcache.until_sample -= aligned) < 0) {
+        sample_block(found_block, size, __builtin_return_address(0));
     }
-    
-    //if we reach here, the block was either not set as allocated or did not
-    //contain the magic number
-}
\ No newline at end of file
+    return get_payload(found_block);
+}
+
+/*
+ * uposix_memalign - posix_memalign over umemalign. Stores the payload in
+ * *memptr and returns 0, or returns EINVAL for a bad alignment and ENOMEM
+ * if the heap could not be extended.
+ */
+int uposix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment % sizeof(void *) != 0) {
+        return EINVAL;
+    }
+    void *payload = umemalign(alignment, size);
+    if (!payload) {
+        return ENOMEM;
+    }
+    *memptr = payload;
+    return 0;
+}
+
+/*
+ * uarena_create - makes an empty region allocator. Chunks are only taken
+ * from umalloc once something is allocated.
+ */
+uarena_t *uarena_create() {
+    uarena_t *arena = umalloc(sizeof(uarena_t));
+    if (!arena) {
+        return NULL;
+    }
+    arena->cursor = NULL;
+    arena->limit = NULL;
+    arena->chunks = NULL;
+    arena->next_chunk = UARENA_CHUNK_MIN;
+    return arena;
+}
+
+/*
+ * uarena_alloc_slow - takes a new chunk from umalloc when the newest one is
+ * full. Chunk sizes double so a busy arena quickly needs few of them, and an
+ * object too big for the next chunk gets a chunk of its own.
+ */
+void *uarena_alloc_slow(uarena_t *arena, size_t size) {
+    size_t bump = arena->next_chunk;
+    if (bump < size) {
+        bump = size;
+    }
+    uarena_chunk_t *chunk = umalloc(sizeof(uarena_chunk_t) + bump);
+    if (!chunk) {
+        return NULL;
+    }
+    chunk->size = bump;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    if (arena->next_chunk < UARENA_CHUNK_MAX) {
+        arena->next_chunk *= 2;
+    }
+
+    char *payload = (char *) (chunk + 1);
+    arena->cursor = payload + size;
+    arena->limit = payload + bump;
+    return payload;
+}
+
+/*
+ * release_chunks - hands a list of chunks back to the heap, taking the
+ * calling thread's arena lock once for all the chunks it owns rather than
+ * once per chunk. Chunks owned by another thread's arena go on its remote
+ * free stack.
+ */
+static void release_chunks(uarena_chunk_t *chunk) {
+    heap_arena_t *own = tcache.arena;
+    bool locked = false;
+    while (chunk) {
+        uarena_chunk_t *next = chunk->next;
+        memory_block_t *block = get_block(chunk);
+        if (block->next == MAGIC_NUM_SAMPLED) {
+            heapprof_forget(chunk);
+        } else if (block->next == MAGIC_NUM_TRACKED) {
+            lifetime_forget(chunk, true);
+            block->next = MAGIC_NUM;
+        }
+        assert(block->next == MAGIC_NUM || block->next == MAGIC_NUM_SAMPLED);
+
+        heap_arena_t *arena = get_arena(block);
+        if (arena != own) {
+            push_remote_free(arena, block);
+        } else {
+            if (!locked) {
+                pthread_mutex_lock(&own->lock);
+                locked = true;
+            }
+            release_block(arena, block);
+        }
+        chunk = next;
+    }
+    if (locked) {
+        pthread_mutex_unlock(&own->lock);
+    }
+}
+
+/*
+ * uarena_reset - frees every object in the arena at once. The newest chunk
+ * is kept for the next round of allocations, the rest go back to the heap.
+ */
+void uarena_reset(uarena_t *arena) {
+    uarena_chunk_t *keep = arena->chunks;
+    if (!keep) {
+        return;
+    }
+    release_chunks(keep->next);
+    keep->next = NULL;
+    arena->cursor = (char *) (keep + 1);
+    arena->limit = arena->cursor + keep->size;
+}
+
+/*
+ * uarena_destroy - frees every object in the arena and the arena itself.
+ */
+void uarena_destroy(uarena_t *arena) {
+    release_chunks(arena->chunks);
+    ufree(arena);
+}
@@ -1,27 +1,205 @@
+#ifndef UMALLOC_H
+#define UMALLOC_H
+
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <stdio.h>
+#include "size_classes.h"
+
+// C++ can't spell _Atomic, std::atomic has the same layout for a pointer
+#ifdef __cplusplus
+#include <atomic>
+#define UMALLOC_ATOMIC(type) std::atomic<type>
+extern "C" {
+#else
+#include <stdatomic.h>
+#define UMALLOC_ATOMIC(type) _Atomic(type)
+#endif
 
 #define ALIGNMENT 16 /* The alignment of all payloads returned by umalloc */
 #define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
 #define HEADER_SIZE 32
+#define REGION_HEADER_SIZE 16 /* sizeof(heap_region_t) */
+#define MIN_PAYLOAD ALIGNMENT /* smallest payload a free block may be left with */
+#define MAX_REQUEST (SIZE_MAX / 4) /* larger requests fail, in umalloc and every entry that aligns a size itself */
 #define MAGIC_NUM (void *) 0xDEADBEEF
 #define MAGIC_NUM_COALESCE (void *) 0xC0A1E5CE
+#define MAGIC_NUM_SAMPLED (void *) 0x5A3B1ED0 /* allocated and tracked by heapprof */
+#define MAGIC_NUM_TRACKED (void *) 0x11FE71AE /* allocated and followed by the lifetime predictor */
+
+/* Flag bits kept in the low bits of block_size_alloc */
+#define BLOCK_ALLOC 0x1 /* block is allocated */
+#define BLOCK_FIRST 0x2 /* block has no physical predecessor in its region */
+#define BLOCK_LAST  0x4 /* block has no physical successor in its region */
+#define BLOCK_FAST  0x8 /* block is parked in a fast bin, still marked allocated */
+
+#define FASTBIN_MAX 128 /* largest payload kept on a fast bin */
+#define NUM_FASTBINS (FASTBIN_MAX / ALIGNMENT)
+#define FASTBIN_THRESHOLD 256 /* fast bin blocks held before a forced consolidate */
+
+#define CACHE_LINE 64
+#define NUM_ARENAS 8 /* arenas threads are spread across */
+#define SHORT_ARENA NUM_ARENAS /* the arena short-lived objects are kept apart in */
+#define NUM_HEAPS (NUM_ARENAS + 1) /* every arena, the short-lived one included */
+#define TCACHE_MAX FASTBIN_MAX /* largest payload kept in a thread cache */
+#define NUM_TCACHE_BINS (TCACHE_MAX / ALIGNMENT)
+#define TCACHE_FILL 16 /* blocks a thread cache bin holds before spilling to its arena */
+#define REALLOC_HEADROOM 4 /* a block that moves to grow gets 1/4 of its size spare */
+#define NUM_COLORS 8 /* cache line offsets new small-object slabs rotate through */
+#define LIFETIME_SHORT_ALLOCS 4096 /* allocations a short-lived object is freed within */
+#define LIFETIME_SAMPLE 64 /* the predictor follows one allocation in this many */
+#define SHORT_ARENA_MIN 65536 /* short-lived bytes asked for before SHORT_ARENA is used */
+#define GOOD_FIT_SLACK 8 /* good fit settles for a block within 1/8 of the request */
+#define PLACEMENT_WINDOW 512 /* finds adaptive placement looks at before deciding */
+#define PLACEMENT_LONG_SEARCH 64 /* free blocks looked at per find that count as slow */
+#define PLACEMENT_SHORT_SEARCH 8 /* free blocks looked at per find that leave room for a tidier policy */
+#define PLACEMENT_FRAGMENTED 50 /* percent of an arena left free that calls for best fit */
 
 /*
- * memory_block_t - Represents a block of memory managed by the heap. The 
+ * memory_block_t - Represents a block of memory managed by the heap. The
  * struct can be left as is, or modified for your design.
- * In the current design bit0 is the allocated bit
- * bits 1-3 are unused.
+ * In the current design bit0 is the allocated bit,
+ * bit1 marks the first block of a contiguous heap region,
+ * bit2 marks the last block of a contiguous heap region,
+ * bit3 marks a block parked in a fast bin,
  * and the remaining 60 bit represent the size.
+ * prev_size holds the payload size of the block physically before this one
+ * so that neighbors can be coalesced without walking the free lists.
+ * While a block is allocated, next holds MAGIC_NUM (MAGIC_NUM_SAMPLED if the
+ * heap profiler sampled it) and prev points at the arena that owns it. The size word of an allocated block is only ever
+ * written under its arena's lock.
  */
 typedef struct memory_block_struct {
     size_t block_size_alloc; //will represent the size of PAYLOAD!
     struct memory_block_struct *next;
     struct memory_block_struct *prev;
-    uint64_t : 64; //8-byte padding to make the header 16-byte aligned.
+    size_t prev_size; //payload size of the physically previous block
 } memory_block_t;
 
+/*
+ * heap_region_t - Sits at the start of every contiguous stretch of memory
+ * an arena gets from csbrk, followed directly by the region's first block.
+ * An arena's regions are linked newest first so the heap can be walked
+ * block by block.
+ */
+typedef struct heap_region_struct {
+    struct heap_region_struct *next;
+    void *end; //one past the last byte of the region
+} heap_region_t;
+
+/*
+ * free_index_t - A packed mirror of one free list, structure of arrays so a
+ * best fit search reads the sizes from a few contiguous cache lines and only
+ * touches the header of the block it picks. Each free block keeps its slot
+ * in the first word of its payload, so removal is a swap with the last slot.
+ * The arrays live in their own mappings, outside the heap.
+ */
+typedef struct {
+    uint32_t *sizes;           //payload size of the block in each slot
+    memory_block_t **blocks;
+    uint32_t count;
+    uint32_t capacity;
+    bool broken; //an insert failed to grow the arrays, search the list instead
+} free_index_t;
+
+/* How find searches a size class for the best fit */
+typedef enum {
+    FREE_SEARCH_AUTO,   /* the fastest search the CPU supports */
+    FREE_SEARCH_LIST,   /* walk the free list, chasing next pointers */
+    FREE_SEARCH_SCALAR, /* scan the packed index one size at a time */
+    FREE_SEARCH_SSE2,
+    FREE_SEARCH_AVX2,
+} free_search_t;
+
+/*
+ * placement_t - How find picks among the free blocks of a size class. The
+ * bounded classes above the request's own hold blocks that all fit, so
+ * every policy but first fit takes the first block of the first one that
+ * isn't empty. First fit looks for the lowest address across all of them.
+ */
+typedef enum {
+    PLACEMENT_BEST_FIT,  /* the smallest block that fits */
+    PLACEMENT_GOOD_FIT,  /* best fit, but stops at a block within GOOD_FIT_SLACK */
+    PLACEMENT_FIRST_FIT, /* the lowest addressed block that fits, in any class */
+    PLACEMENT_NEXT_FIT,  /* the first that fits, resuming where the class's last search ended */
+    PLACEMENT_ADAPTIVE,  /* switches between the others as the heap changes */
+    NUM_PLACEMENTS
+} placement_t;
+
+/*
+ * lifetime_t - How long an object is expected to live. Short-lived objects
+ * are freed within about LIFETIME_SHORT_ALLOCS allocations and are kept in
+ * SHORT_ARENA, away from the long-lived ones they would otherwise pin.
+ */
+typedef enum {
+    LIFETIME_UNKNOWN, /* ask the predictor, or treat as long-lived without it */
+    LIFETIME_SHORT,
+    LIFETIME_LONG,
+} lifetime_t;
+
+/*
+ * phase_t - The slow path phases timed by a build with -DUMALLOC_PHASES
+ * (make PHASES=1). Phases nest: extend includes morecore and the coalesce
+ * with the old last block, consolidate's coalesces and inserts count too.
+ */
+typedef enum {
+    PHASE_FIND,     /* items are free blocks or index entries looked at */
+    PHASE_SPLIT,
+    PHASE_EXTEND,
+    PHASE_MORECORE, /* csbrk, chuge or cpersist, items are bytes */
+    PHASE_COALESCE,
+    PHASE_INSERT,   /* insert_free */
+    NUM_PHASES
+} phase_t;
+
+typedef struct {
+    uint64_t calls;
+    uint64_t ticks; //cycles where the CPU has a time stamp counter, else ns
+    uint64_t items; //phase specific, see phase_t
+} phase_stats_t;
+
+/*
+ * heap_arena_t - An independent heap with its own lock, free lists and
+ * fast bins. Threads are spread across the arenas so they rarely contend,
+ * and threads of other arenas hand back blocks through remote_frees so a
+ * cross-thread free never waits on the owner's lock.
+ * Each arena starts on its own cache line so two arenas never share one.
+ */
+typedef struct heap_arena_struct {
+    pthread_mutex_t lock;
+    // One free list per size class. Each list is doubly linked and NULL
+    // terminated, the first block in a list has a NULL prev.
+    memory_block_t *free_lists[NUM_SIZE_CLASSES];
+    free_index_t free_index[NUM_SIZE_CLASSES]; //packed sizes of each list
+    // Quick lists of recently freed small blocks, one per aligned size up to
+    // FASTBIN_MAX, singly linked through next.
+    memory_block_t *fastbins[NUM_FASTBINS];
+    size_t fastbin_count;
+    // The arena's regions, newest first, and the last block of the newest
+    // one. Used to grow the region in place when csbrk hands back contiguous
+    // memory.
+    heap_region_t *regions;
+    memory_block_t *heap_last;
+    size_t threads; //number of threads assigned to this arena
+    // Blocks freed by threads of other arenas. A lock-free stack linked
+    // through next, pushed with a single CAS and drained in one exchange by
+    // the arena's slow path.
+    UMALLOC_ATOMIC(memory_block_t *) remote_frees;
+    unsigned next_color; //color of the next slab that starts a region
+    // The policy find uses now, and the index slot next fit resumes at in
+    // each class
+    placement_t placement;
+    uint32_t rovers[NUM_SIZE_CLASSES];
+    // Adaptive placement's window: finds so far and free blocks they looked at
+    uint32_t window_finds;
+    uint64_t window_scanned;
+    // Always present so every build agrees on the layout, only counted with
+    // -DUMALLOC_PHASES. Updated under the arena's lock.
+    phase_stats_t phases[NUM_PHASES];
+} __attribute__((aligned(CACHE_LINE))) heap_arena_t;
+
 // Helper Functions, this may be editted if you change the signature in umalloc.c
 bool is_allocated(memory_block_t *block);
 void allocate(memory_block_t *block);
@@ -34,13 +212,171 @@ memory_block_t *get_block(void *payload);
 void add_to_alloc_list(memory_block_t *block);
 void remove_from_alloc_list(memory_block_t *block);
 
-memory_block_t *find(size_t size);
-memory_block_t *extend(size_t size);
-memory_block_t *split(memory_block_t *block, size_t size);
-memory_block_t *coalesce(memory_block_t *block);
+bool is_first(memory_block_t *block);
+bool is_last(memory_block_t *block);
+bool is_fast(memory_block_t *block);
+memory_block_t *get_phys_next(memory_block_t *block);
+memory_block_t *get_phys_prev(memory_block_t *block);
+memory_block_t *get_region_first(heap_region_t *region);
+heap_arena_t *get_arena(memory_block_t *block);
+int get_size_class(size_t size);
+void insert_free(heap_arena_t *arena, memory_block_t *block);
+void remove_free(heap_arena_t *arena, memory_block_t *block);
+void consolidate(heap_arena_t *arena);
+void collect_remote_frees(heap_arena_t *arena);
+
+void index_insert(free_index_t *index, memory_block_t *block);
+void index_remove(free_index_t *index, memory_block_t *block);
+uint32_t index_get_slot(memory_block_t *block);
+int64_t index_best_fit(free_index_t *index, size_t size, free_search_t search);
+free_search_t resolve_free_search(free_search_t search);
+const char *free_search_name(free_search_t search);
+const char *placement_name(placement_t placement);
+
+lifetime_t lifetime_predict(void *site, int size_class);
+bool lifetime_track(void *ptr, void *site, int size_class);
+void lifetime_forget(void *ptr, bool freed);
+void lifetime_reset();
+
+memory_block_t *find(heap_arena_t *arena, size_t size);
+memory_block_t *extend(heap_arena_t *arena, size_t size);
+memory_block_t *split(heap_arena_t *arena, memory_block_t *block, size_t size);
+memory_block_t *coalesce(heap_arena_t *arena, memory_block_t *block);
+memory_block_t *slide_down(heap_arena_t *arena, memory_block_t *block);
+memory_block_t *move_lower(heap_arena_t *arena, memory_block_t *block, size_t limit, size_t *scanned);
+size_t trim_heap(heap_arena_t *arena);
+void uhandle_reset();
 
 
 // Portion that may not be edited
 int uinit();
 void *umalloc(size_t size);
-void ufree(void *ptr);
\ No newline at end of file
+void ufree(void *ptr);
+
+// Opt in to a heap backed by transparent huge pages, takes effect at uinit
+void umalloc_use_hugepages(bool enable);
+
+// A heap kept in a file that a restarted process reattaches to, takes effect at uinit
+#define PERSIST_DEFAULT_CAPACITY (256UL * 1024 * 1024) /* sparse file size for UMALLOC_PERSIST */
+void umalloc_persist(const char *path, size_t capacity);
+void upersist_set_root(void *ptr);
+void *upersist_get_root();
+void *upersist_base();
+int upersist_close();
+
+// Per phase slow path breakdown summed over the arenas, needs -DUMALLOC_PHASES
+void umalloc_phase_report(FILE *out);
+
+// Allocation with a lifetime hint, the payload is released with ufree
+void *umalloc_hint(size_t size, lifetime_t lifetime);
+// Route plain umalloc calls by a lifetime predicted from the call site and
+// size class, takes effect at uinit
+void umalloc_predict_lifetimes(bool enable);
+
+// Cache colors new small-object slabs rotate through, 1 turns coloring off,
+// takes effect at uinit
+void umalloc_set_colors(unsigned colors);
+
+// Pick how find searches the free lists, for benchmarking the searches
+void umalloc_set_free_search(free_search_t search);
+// Pick how find places requests among the free blocks, takes effect at
+// uinit, and the policy the calling thread's arena is using right now
+void umalloc_set_placement(placement_t placement);
+placement_t umalloc_placement();
+
+// Aligned allocation, payloads are released with ufree
+void *umemalign(size_t alignment, size_t size);
+int uposix_memalign(void **memptr, size_t alignment, size_t size);
+
+// Resizes within free neighbors when it can, otherwise moves the contents
+void *urealloc(void *ptr, size_t size);
+
+/*
+ * uhandle_t - Names an object umalloc may move to compact the heap. The
+ * object is only reachable through uhandle_pin, and stays put until the
+ * matching uhandle_unpin.
+ */
+typedef uint32_t uhandle_t;
+#define UHANDLE_NULL 0
+#define UHANDLE_MIN_CAPACITY 1024 /* first handle table size, it doubles from there */
+
+uhandle_t uhandle_alloc(size_t size);
+void *uhandle_pin(uhandle_t handle);
+void uhandle_unpin(uhandle_t handle);
+void uhandle_free(uhandle_t handle);
+bool uhandle_compact(size_t budget);
+
+/*
+ * ushared_t - A heap in a shared memory segment that several processes
+ * map. Objects in it are named by offsets, which mean the same thing in
+ * every process, 0 naming none.
+ */
+typedef struct ushared_struct ushared_t;
+
+ushared_t *ushared_create(const char *name, size_t capacity);
+ushared_t *ushared_open(const char *name);
+ushared_t *ushared_attach_fd(int fd);
+int ushared_fd(ushared_t *heap);
+uint64_t ushared_alloc(ushared_t *heap, size_t size);
+void ushared_free(ushared_t *heap, uint64_t offset);
+void *ushared_ptr(ushared_t *heap, uint64_t offset);
+uint64_t ushared_offset(ushared_t *heap, void *ptr);
+uint64_t ushared_recoveries(ushared_t *heap);
+int ushared_lock(ushared_t *heap);
+void ushared_unlock(ushared_t *heap);
+int ushared_check(ushared_t *heap);
+void ushared_close(ushared_t *heap);
+int ushared_unlink(const char *name);
+
+#define UARENA_CHUNK_MIN 4096   /* first chunk a uarena takes from umalloc */
+#define UARENA_CHUNK_MAX 32768  /* chunks double up to this size */
+
+/*
+ * uarena_chunk_t - Heads every chunk a uarena takes from umalloc, the bump
+ * space follows directly.
+ */
+typedef struct uarena_chunk_struct {
+    struct uarena_chunk_struct *next;
+    size_t size; //bytes of bump space after the header
+} uarena_chunk_t;
+
+/*
+ * uarena_t - A region allocator on top of umalloc. Objects are bumped out of
+ * the newest chunk with no header of their own and can't be freed one by
+ * one, uarena_reset or uarena_destroy hands all the chunks back at once.
+ */
+typedef struct {
+    char *cursor; //next free byte in the newest chunk
+    char *limit;  //one past the newest chunk's bump space
+    uarena_chunk_t *chunks; //newest first
+    size_t next_chunk; //bump space of the next chunk taken
+} uarena_t;
+
+uarena_t *uarena_create();
+void *uarena_alloc_slow(uarena_t *arena, size_t size);
+void uarena_reset(uarena_t *arena);
+void uarena_destroy(uarena_t *arena);
+
+/*
+ * uarena_alloc - bumps size bytes out of the arena. The payload is aligned
+ * to ALIGNMENT and lives until the arena is reset or destroyed. Returns NULL
+ * past MAX_REQUEST or if the heap could not grow.
+ */
+static inline void *uarena_alloc(uarena_t *arena, size_t size) {
+    if (size > MAX_REQUEST) {
+        return NULL;
+    }
+    size_t aligned = ALIGN(size ? size : 1);
+    if ((size_t) (arena->limit - arena->cursor) >= aligned) {
+        void *payload = arena->cursor;
+        arena->cursor += aligned;
+        return payload;
+    }
+    return uarena_alloc_slow(arena, aligned);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UMALLOC_H */
@@ -0,0 +1,502 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * ushared.c - A heap inside a shared memory segment, from shm_open or
+ * memfd_create, that several processes map at whatever address they get.
+ * Nothing in the segment holds a pointer: free list links are offsets from
+ * the start of the segment, and objects are handed between processes as
+ * offsets too, so a producer can build a message in place and pass its
+ * consumer eight bytes.
+ *
+ * The segment is carved into blocks with the same boundary tags and size
+ * classes umalloc uses, under one process-shared robust mutex. Every change
+ * to the blocks ends with a single store to a size word, so walking the
+ * blocks by size always works even if a process dies halfway through. The
+ * next process to take the lock after such a death walks the blocks and
+ * rebuilds the free lists from them. Blocks the dead process held are not
+ * freed, nothing says whether it handed them on before it died.
+ **************************************************************************/
+
+#define _GNU_SOURCE
+#include "umalloc.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define USHARED_MAGIC 0x4448534C4C414D55ULL /* "UMALLSHD" read little endian */
+#define USHARED_NONE 0 /* the offset naming no block, the header sits there */
+
+/*
+ * ushared_header_t - The start of the segment. Free lists hold the offset
+ * of their first block.
+ */
+typedef struct {
+    uint64_t magic;      //written last by ushared_create
+    uint64_t capacity;   //size of the segment
+    uint64_t heap_start; //offset of the first block
+    uint64_t recoveries; //times the lock was taken over from a dead process
+    pthread_mutex_t lock;
+    uint64_t free_lists[NUM_SIZE_CLASSES];
+} ushared_header_t;
+
+/*
+ * ushared_block_t - memory_block_t with offsets for links. The flags are
+ * the BLOCK_ bits, BLOCK_FIRST and BLOCK_LAST mark the ends of the heap.
+ */
+typedef struct {
+    uint64_t block_size_alloc; //payload size and flags
+    uint64_t prev_size;        //payload size of the physically previous block
+    uint64_t next;             //free list links, only meaningful while free
+    uint64_t prev;
+} ushared_block_t;
+
+_Static_assert(sizeof(ushared_block_t) == HEADER_SIZE, "shared blocks use umalloc's header size");
+
+/* What a process knows about a segment it has mapped */
+struct ushared_struct {
+    ushared_header_t *header;
+    size_t size; //bytes mapped, the header's capacity once it is checked
+    int fd;
+};
+
+static ushared_block_t *block_at(ushared_t *heap, uint64_t offset) {
+    return (ushared_block_t *) ((char *) heap->header + offset);
+}
+
+static uint64_t offset_of(ushared_t *heap, ushared_block_t *block) {
+    return (char *) block - (char *) heap->header;
+}
+
+static size_t block_size(ushared_block_t *block) {
+    return block->block_size_alloc & ~(size_t) (ALIGNMENT - 1);
+}
+
+static ushared_block_t *phys_next(ushared_block_t *block) {
+    return (ushared_block_t *) ((char *) block + HEADER_SIZE + block_size(block));
+}
+
+static ushared_block_t *phys_prev(ushared_block_t *block) {
+    return (ushared_block_t *) ((char *) block - HEADER_SIZE - block->prev_size);
+}
+
+/*
+ * publish - the store that makes a change to the blocks visible to a walk.
+ * Everything written before it is in memory before it.
+ */
+static void publish(ushared_block_t *block, uint64_t size_alloc) {
+    __atomic_store_n(&block->block_size_alloc, size_alloc, __ATOMIC_RELEASE);
+}
+
+/*
+ * push_free - puts a free block at the front of its class's list.
+ */
+static void push_free(ushared_t *heap, ushared_block_t *block) {
+    uint64_t *list = &heap->header->free_lists[get_size_class(block_size(block))];
+    uint64_t offset = offset_of(heap, block);
+    block->prev = USHARED_NONE;
+    block->next = *list;
+    if (*list != USHARED_NONE) {
+        block_at(heap, *list)->prev = offset;
+    }
+    *list = offset;
+}
+
+/*
+ * unlink_free - takes a free block off its class's list.
+ */
+static void unlink_free(ushared_t *heap, ushared_block_t *block) {
+    if (block->prev != USHARED_NONE) {
+        block_at(heap, block->prev)->next = block->next;
+    } else {
+        heap->header->free_lists[get_size_class(block_size(block))] = block->next;
+    }
+    if (block->next != USHARED_NONE) {
+        block_at(heap, block->next)->prev = block->prev;
+    }
+}
+
+/*
+ * plausible - whether a size word can belong to a block starting at
+ * offset, so a walk never leaves the segment.
+ */
+static bool plausible(ushared_t *heap, uint64_t offset, uint64_t size_alloc) {
+    uint64_t size = size_alloc & ~(uint64_t) (ALIGNMENT - 1);
+    uint64_t end = offset + HEADER_SIZE + size;
+    return size >= MIN_PAYLOAD && end > offset && end <= heap->header->capacity &&
+           ((size_alloc & BLOCK_LAST) != 0) == (end == heap->header->capacity);
+}
+
+/*
+ * recover - rebuilds the free lists from the blocks after a process died
+ * holding the lock. Free neighbors are merged and prev_size is rewritten on
+ * the way. Returns -1 if the blocks themselves don't add up.
+ */
+static int recover(ushared_t *heap) {
+    ushared_header_t *header = heap->header;
+    memset(header->free_lists, 0, sizeof(header->free_lists));
+
+    uint64_t offset = header->heap_start;
+    ushared_block_t *before = NULL;
+    while (offset < header->capacity) {
+        ushared_block_t *block = block_at(heap, offset);
+        if (!plausible(heap, offset, block->block_size_alloc)) {
+            return -1;
+        }
+        //the dead process may have left two free blocks side by side
+        if (before && !(before->block_size_alloc & BLOCK_ALLOC) && !(block->block_size_alloc & BLOCK_ALLOC)) {
+            unlink_free(heap, before);
+            uint64_t flags = (before->block_size_alloc & BLOCK_FIRST) | (block->block_size_alloc & BLOCK_LAST);
+            publish(before, (block_size(before) + HEADER_SIZE + block_size(block)) | flags);
+            block = before;
+        } else {
+            block->prev_size = before ? block_size(before) : 0;
+        }
+        if (!(block->block_size_alloc & BLOCK_ALLOC)) {
+            push_free(heap, block);
+        }
+        before = block;
+        offset = offset_of(heap, phys_next(block));
+    }
+    return 0;
+}
+
+/*
+ * lock_heap - takes the segment's lock, recovering the heap first if the
+ * last process to hold it died. Returns -1 if the heap can't be used.
+ */
+static int lock_heap(ushared_t *heap) {
+    ushared_header_t *header = heap->header;
+    int err = pthread_mutex_lock(&header->lock);
+    if (err == EOWNERDEAD) {
+        if (recover(heap) != 0) {
+            //unlocking without pthread_mutex_consistent retires the lock for good
+            pthread_mutex_unlock(&header->lock);
+            return -1;
+        }
+        header->recoveries++;
+        pthread_mutex_consistent(&header->lock);
+        return 0;
+    }
+    return err == 0 ? 0 : -1;
+}
+
+/*
+ * map_segment - maps the segment behind fd and checks it holds a heap.
+ * Takes over fd.
+ */
+static ushared_t *map_segment(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(ushared_header_t)) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ushared_t *heap = malloc(sizeof(ushared_t));
+    if (map == MAP_FAILED || !heap) {
+        if (map != MAP_FAILED) {
+            munmap(map, st.st_size);
+        }
+        free(heap);
+        close(fd);
+        return NULL;
+    }
+    heap->header = map;
+    heap->size = st.st_size;
+    heap->fd = fd;
+    if (__atomic_load_n(&heap->header->magic, __ATOMIC_ACQUIRE) != USHARED_MAGIC ||
+        heap->header->capacity != (uint64_t) st.st_size) {
+        fprintf(stderr, "shared memory segment is not a shared heap\n");
+        ushared_close(heap);
+        return NULL;
+    }
+    return heap;
+}
+
+/*
+ * ushared_create - creates a shared heap of capacity bytes. A name creates
+ * a POSIX shared memory object other processes ushared_open by that name,
+ * and fails if it exists. NULL creates an anonymous memfd, which reaches
+ * other processes through fork or ushared_fd. Returns NULL on failure.
+ */
+ushared_t *ushared_create(const char *name, size_t capacity) {
+    size_t heap_start = ALIGN(sizeof(ushared_header_t));
+    capacity &= ~(size_t) (ALIGNMENT - 1);
+    if (capacity < heap_start + HEADER_SIZE + MIN_PAYLOAD) {
+        return NULL;
+    }
+    int fd = name ? shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600) : memfd_create("ushared", MFD_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, capacity) == 0) {
+        map = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (map == MAP_FAILED) {
+        close(fd);
+        if (name) {
+            shm_unlink(name);
+        }
+        return NULL;
+    }
+
+    ushared_header_t *header = map;
+    header->capacity = capacity;
+    header->heap_start = heap_start;
+    header->recoveries = 0;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&header->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    //one free block spans the whole heap
+    ushared_block_t *block = (ushared_block_t *) ((char *) map + heap_start);
+    block->block_size_alloc = (capacity - heap_start - HEADER_SIZE) | BLOCK_FIRST | BLOCK_LAST;
+    block->prev_size = 0;
+    block->next = USHARED_NONE;
+    block->prev = USHARED_NONE;
+    memset(header->free_lists, 0, sizeof(header->free_lists));
+    header->free_lists[get_size_class(block_size(block))] = heap_start;
+    __atomic_store_n(&header->magic, USHARED_MAGIC, __ATOMIC_RELEASE);
+    munmap(map, capacity);
+    return map_segment(fd);
+}
+
+/*
+ * ushared_open - maps the shared heap another process created under name.
+ */
+ushared_t *ushared_open(const char *name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    return fd < 0 ? NULL : map_segment(fd);
+}
+
+/*
+ * ushared_attach_fd - maps a shared heap from a descriptor another process
+ * passed over a socket. Takes over fd.
+ */
+ushared_t *ushared_attach_fd(int fd) {
+    return map_segment(fd);
+}
+
+/*
+ * ushared_fd - the descriptor behind the heap, to pass to another process.
+ * It stays owned by the heap.
+ */
+int ushared_fd(ushared_t *heap) {
+    return heap->fd;
+}
+
+/*
+ * find_block - the best fit in size's class, or else the first block of a
+ * larger class, every one of which fits. Caller holds the lock.
+ */
+static ushared_block_t *find_block(ushared_t *heap, size_t size) {
+    int size_class = get_size_class(size);
+    ushared_block_t *best = NULL;
+    for (uint64_t offset = heap->header->free_lists[size_class]; offset != USHARED_NONE;) {
+        ushared_block_t *block = block_at(heap, offset);
+        if (block_size(block) >= size && (!best || block_size(block) < block_size(best))) {
+            best = block;
+            if (block_size(block) == size) {
+                break;
+            }
+        }
+        offset = block->next;
+    }
+    for (int i = size_class + 1; !best && i < NUM_SIZE_CLASSES; i++) {
+        if (heap->header->free_lists[i] != USHARED_NONE) {
+            best = block_at(heap, heap->header->free_lists[i]);
+        }
+    }
+    return best;
+}
+
+/*
+ * ushared_alloc - allocates size bytes in the shared heap. Returns the
+ * payload's offset, which every process mapping the heap can turn into a
+ * pointer with ushared_ptr, or 0 if the heap is full.
+ */
+uint64_t ushared_alloc(ushared_t *heap, size_t size) {
+    if (size > heap->header->capacity) {
+        return USHARED_NONE;
+    }
+    size = size < MIN_PAYLOAD ? MIN_PAYLOAD : ALIGN(size);
+    if (lock_heap(heap) != 0) {
+        return USHARED_NONE;
+    }
+    ushared_block_t *block = find_block(heap, size);
+    if (!block) {
+        pthread_mutex_unlock(&heap->header->lock);
+        return USHARED_NONE;
+    }
+    unlink_free(heap, block);
+
+    uint64_t flags = block->block_size_alloc & (BLOCK_FIRST | BLOCK_LAST);
+    size_t spare = block_size(block) - size;
+    if (spare >= HEADER_SIZE + MIN_PAYLOAD) {
+        //the remainder's tag is in place before the size store makes it a block
+        ushared_block_t *rest = (ushared_block_t *) ((char *) block + HEADER_SIZE + size);
+        rest->block_size_alloc = (spare - HEADER_SIZE) | (flags & BLOCK_LAST);
+        rest->prev_size = size;
+        if (!(flags & BLOCK_LAST)) {
+            phys_next(rest)->prev_size = block_size(rest);
+        }
+        publish(block, size | (flags & BLOCK_FIRST) | BLOCK_ALLOC);
+        push_free(heap, rest);
+    } else {
+        publish(block, block_size(block) | flags | BLOCK_ALLOC);
+    }
+    pthread_mutex_unlock(&heap->header->lock);
+    return offset_of(heap, block) + HEADER_SIZE;
+}
+
+/*
+ * ushared_free - frees the object at offset, whichever process allocated
+ * it. 0 is ignored.
+ */
+void ushared_free(ushared_t *heap, uint64_t offset) {
+    if (offset == USHARED_NONE) {
+        return;
+    }
+    ushared_block_t *block = block_at(heap, offset - HEADER_SIZE);
+    if (lock_heap(heap) != 0) {
+        return;
+    }
+    assert(block->block_size_alloc & BLOCK_ALLOC);
+
+    ushared_block_t *start = block;
+    uint64_t flags = block->block_size_alloc & (BLOCK_FIRST | BLOCK_LAST);
+    size_t size = block_size(block);
+    if (!(flags & BLOCK_FIRST) && !(phys_prev(block)->block_size_alloc & BLOCK_ALLOC)) {
+        start = phys_prev(block);
+        unlink_free(heap, start);
+        size += HEADER_SIZE + block_size(start);
+        flags = (flags & BLOCK_LAST) | (start->block_size_alloc & BLOCK_FIRST);
+    }
+    if (!(flags & BLOCK_LAST) && !(phys_next(block)->block_size_alloc & BLOCK_ALLOC)) {
+        ushared_block_t *next = phys_next(block);
+        unlink_free(heap, next);
+        size += HEADER_SIZE + block_size(next);
+        flags = (flags & BLOCK_FIRST) | (next->block_size_alloc & BLOCK_LAST);
+    }
+    //one store frees the block and swallows its free neighbors
+    ushared_block_t *after = (ushared_block_t *) ((char *) start + HEADER_SIZE + size);
+    if (!(flags & BLOCK_LAST)) {
+        after->prev_size = size;
+    }
+    publish(start, size | flags);
+    push_free(heap, start);
+    pthread_mutex_unlock(&heap->header->lock);
+}
+
+/*
+ * ushared_ptr - where the object at offset is mapped in this process, NULL
+ * for 0.
+ */
+void *ushared_ptr(ushared_t *heap, uint64_t offset) {
+    return offset == USHARED_NONE ? NULL : (char *) heap->header + offset;
+}
+
+/*
+ * ushared_offset - the offset another process can find ptr by, 0 for NULL.
+ */
+uint64_t ushared_offset(ushared_t *heap, void *ptr) {
+    return ptr ? (uint64_t) ((char *) ptr - (char *) heap->header) : USHARED_NONE;
+}
+
+/*
+ * ushared_recoveries - how many times the heap was recovered after a
+ * process died holding its lock.
+ */
+uint64_t ushared_recoveries(ushared_t *heap) {
+    return heap->header->recoveries;
+}
+
+/*
+ * ushared_lock - holds the heap's lock so a run of reads through ushared_ptr
+ * sees no other process's changes. ushared_alloc, ushared_free and
+ * ushared_check can't be called until ushared_unlock. A process that dies
+ * holding it leaves the heap to be recovered by the next one to lock it.
+ * Returns -1 if the heap can't be used.
+ */
+int ushared_lock(ushared_t *heap) {
+    return lock_heap(heap);
+}
+
+/*
+ * ushared_unlock - lets other processes at the heap again.
+ */
+void ushared_unlock(ushared_t *heap) {
+    pthread_mutex_unlock(&heap->header->lock);
+}
+
+/*
+ * ushared_check - checks the blocks tile the heap with consistent tags and
+ * no free neighbors, and that the free lists hold exactly the free blocks,
+ * each in its own class. Returns 0 if the heap is consistent, -1 otherwise.
+ */
+int ushared_check(ushared_t *heap) {
+    if (lock_heap(heap) != 0) {
+        return -1;
+    }
+    ushared_header_t *header = heap->header;
+    int err = 0;
+    size_t free_blocks = 0;
+    uint64_t offset = header->heap_start;
+    ushared_block_t *before = NULL;
+    while (!err && offset < header->capacity) {
+        ushared_block_t *block = block_at(heap, offset);
+        bool first = (block->block_size_alloc & BLOCK_FIRST) != 0;
+        if (!plausible(heap, offset, block->block_size_alloc) || first != (before == NULL) ||
+            (before && block->prev_size != block_size(before))) {
+            err = -1;
+        } else if (!(block->block_size_alloc & BLOCK_ALLOC)) {
+            free_blocks++;
+            if (before && !(before->block_size_alloc & BLOCK_ALLOC)) {
+                err = -1;
+            }
+        }
+        before = block;
+        offset = offset_of(heap, phys_next(block));
+    }
+
+    for (int i = 0; !err && i < NUM_SIZE_CLASSES; i++) {
+        uint64_t prev = USHARED_NONE;
+        for (offset = header->free_lists[i]; !err && offset != USHARED_NONE;) {
+            ushared_block_t *block = block_at(heap, offset);
+            if (free_blocks == 0 || block->prev != prev || (block->block_size_alloc & BLOCK_ALLOC) ||
+                get_size_class(block_size(block)) != i) {
+                err = -1;
+            }
+            free_blocks--;
+            prev = offset;
+            offset = block->next;
+        }
+    }
+    pthread_mutex_unlock(&header->lock);
+    return err || free_blocks != 0 ? -1 : 0;
+}
+
+/*
+ * ushared_close - unmaps the heap from this process. The segment lives on
+ * while other processes have it mapped, or until ushared_unlink if it has
+ * a name.
+ */
+void ushared_close(ushared_t *heap) {
+    munmap(heap->header, heap->size);
+    close(heap->fd);
+    free(heap);
+}
+
+/*
+ * ushared_unlink - removes the name of a shared heap made by ushared_create.
+ */
+int ushared_unlink(const char *name) {
+    return shm_unlink(name);
+}